@@ -0,0 +1,93 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "tinycontext.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+namespace utils
+{
+#if defined(TINYCONTEXT_ASM)
+
+extern "C" void tiny_context_start();
+
+// The frame must match what tiny_context_switch pops in tinycontext.S
+void tiny_context_make(TinyContext* ctx, void* stack, size_t stack_size, void (*entry)(void*), void* param)
+{
+    uintptr_t top = ((uintptr_t)stack + stack_size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+    // fpu control, r15, r14, r13, r12, rbx, rbp, return address
+    uint64_t* frame = (uint64_t*)top - 8;
+    memset(frame, 0, 8 * sizeof(uint64_t));
+    uint32_t mxcsr = 0x1F80;
+    uint16_t fpucw = 0x037F;
+    memcpy((uint8_t*)frame, &mxcsr, sizeof(mxcsr));
+    memcpy((uint8_t*)frame + 4, &fpucw, sizeof(fpucw));
+    frame[3] = (uint64_t)entry;
+    frame[4] = (uint64_t)param;
+    frame[7] = (uint64_t)tiny_context_start;
+#elif defined(__aarch64__)
+    // d8-d15, x19-x30, fpcr, padding
+    uint64_t* frame = (uint64_t*)top - 22;
+    memset(frame, 0, 22 * sizeof(uint64_t));
+    frame[8] = (uint64_t)param;
+    frame[9] = (uint64_t)entry;
+    frame[19] = (uint64_t)tiny_context_start;
+#endif
+
+    ctx->sp = frame;
+}
+
+#else
+
+namespace
+{
+void context_start(unsigned int entry_hi, unsigned int entry_lo, unsigned int param_hi, unsigned int param_lo)
+{
+    void (*entry)(void*) = (void (*)(void*))(uintptr_t)(((uint64_t)entry_hi << 32) | entry_lo);
+    void* param = (void*)(uintptr_t)(((uint64_t)param_hi << 32) | param_lo);
+    entry(param);
+}
+} // namespace
+
+void tiny_context_make(TinyContext* ctx, void* stack, size_t stack_size, void (*entry)(void*), void* param)
+{
+    uint64_t e = (uint64_t)(uintptr_t)entry;
+    uint64_t p = (uint64_t)(uintptr_t)param;
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_link = nullptr;
+    makecontext(&ctx->uc, (void (*)())context_start, 4, (unsigned int)(e >> 32), (unsigned int)e, (unsigned int)(p >> 32), (unsigned int)p);
+}
+
+extern "C" void tiny_context_switch(TinyContext* from, TinyContext* to)
+{
+    swapcontext(&from->uc, &to->uc);
+}
+
+#endif
+} // namespace utils
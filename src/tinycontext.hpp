@@ -0,0 +1,55 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define TINYCONTEXT_ASM 1
+#else
+#include <ucontext.h>
+#endif
+
+namespace utils
+{
+// Minimal execution context for POSIX fibers. Only callee saved registers are stored, on the
+// stack of the suspended context, so a switch is a handful of loads and stores without any syscall.
+// Targets without an assembly implementation fall back to ucontext.
+struct TinyContext
+{
+#ifdef TINYCONTEXT_ASM
+    void* sp;
+#else
+    ucontext_t uc;
+#endif
+};
+
+// Prepares ctx to call entry(param) on the given stack the first time it is switched to.
+// entry must never return.
+void tiny_context_make(TinyContext* ctx, void* stack, size_t stack_size, void (*entry)(void*), void* param);
+
+// Saves the current context to from and resumes to. from may be an uninitialized context.
+extern "C" void tiny_context_switch(TinyContext* from, TinyContext* to);
+} // namespace utils
@@ -0,0 +1,300 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+namespace utils
+{
+enum class TinyDequeStatus
+{
+    SUCCESS = 0,
+    EMPTY = 1,
+    FULL = 2,
+    ABORT = 3, // lost a race against another thief or the owner, try again
+    MEMORY_ERROR = 4,
+    INVALID_ARGUMENT = 5
+};
+
+// Bounded Chase-Lev work-stealing deque, see "Correct and Efficient Work-Stealing for Weak Memory Models"
+// by Lê, Pop, Cohen and Zappa Nardelli. One owner thread pushes and pops at the bottom (LIFO), any thread
+// may steal from the top (FIFO). Elements are stored as relaxed atomic words, so a thief that loses the
+// race reads a torn element it throws away instead of racing on plain memory.
+template <typename T>
+class TinyWorkStealingDeque
+{
+    static_assert(std::is_trivially_copyable<T>::value, "TinyWorkStealingDeque only supports trivially copyable types");
+
+public:
+    TinyWorkStealingDeque()
+        : m_top(0)
+        , m_bottom(0)
+        , m_mask(0)
+        , m_slots(nullptr)
+    {
+    }
+
+    ~TinyWorkStealingDeque()
+    {
+        free();
+    }
+
+    TinyWorkStealingDeque(const TinyWorkStealingDeque&) = delete;
+    TinyWorkStealingDeque& operator=(const TinyWorkStealingDeque&) = delete;
+
+    // capacity must be a power of two
+    TinyDequeStatus init(int64_t capacity)
+    {
+        if (capacity <= 0 || (capacity & (capacity - 1)) != 0)
+            return TinyDequeStatus::INVALID_ARGUMENT;
+
+        m_slots = new (std::nothrow) std::atomic<uintptr_t>[capacity * WORDS];
+        if (m_slots == nullptr)
+            return TinyDequeStatus::MEMORY_ERROR;
+
+        m_mask = capacity - 1;
+        m_top = 0;
+        m_bottom = 0;
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    TinyDequeStatus free()
+    {
+        delete[] m_slots;
+        m_slots = nullptr;
+        m_mask = 0;
+        m_top = 0;
+        m_bottom = 0;
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Owner only
+    TinyDequeStatus push(const T& src)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed);
+        const int64_t t = m_top.load(std::memory_order_acquire);
+        if (b - t > m_mask)
+            return TinyDequeStatus::FULL;
+
+        store(b, src);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Owner only
+    TinyDequeStatus pop(T* dst)
+    {
+        const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return TinyDequeStatus::EMPTY;
+        }
+
+        load(b, dst);
+        if (t == b)
+        {
+            // Last element, race against thieves
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won)
+                return TinyDequeStatus::EMPTY;
+        }
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Any thread
+    TinyDequeStatus steal(T* dst)
+    {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+            return TinyDequeStatus::EMPTY;
+
+        T element;
+        load(t, &element);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return TinyDequeStatus::ABORT;
+
+        *dst = element;
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Approximate when called concurrently
+    int64_t count() const
+    {
+        int64_t n = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+        return n < 0 ? 0 : n;
+    }
+
+    bool empty() const
+    {
+        return count() == 0;
+    }
+
+    int64_t capacity() const
+    {
+        return m_slots == nullptr ? 0 : m_mask + 1;
+    }
+
+    bool is_inited() const
+    {
+        return m_slots != nullptr;
+    }
+
+private:
+    static const int64_t WORDS = (sizeof(T) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+
+    void store(int64_t index, const T& src)
+    {
+        uintptr_t words[WORDS] = {};
+        memcpy(words, &src, sizeof(T));
+        std::atomic<uintptr_t>* slot = m_slots + (index & m_mask) * WORDS;
+        for (int64_t i = 0; i < WORDS; ++i)
+            slot[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    void load(int64_t index, T* dst) const
+    {
+        uintptr_t words[WORDS];
+        const std::atomic<uintptr_t>* slot = m_slots + (index & m_mask) * WORDS;
+        for (int64_t i = 0; i < WORDS; ++i)
+            words[i] = slot[i].load(std::memory_order_relaxed);
+        memcpy(dst, words, sizeof(T));
+    }
+
+    alignas(64) std::atomic_int64_t m_top;
+    alignas(64) std::atomic_int64_t m_bottom;
+    int64_t m_mask;
+    std::atomic<uintptr_t>* m_slots;
+};
+
+// Single element slot with the same ownership as TinyWorkStealingDeque: one owner thread puts and takes,
+// any thread may steal. Every put and take bumps a version that is odd while the slot holds an element,
+// so a thief can tell that the element it looked at earlier is still the same one.
+template <typename T>
+class TinyRunNextSlot
+{
+    static_assert(std::is_trivially_copyable<T>::value, "TinyRunNextSlot only supports trivially copyable types");
+
+public:
+    TinyRunNextSlot()
+        : m_version(0)
+    {
+        for (int64_t i = 0; i < WORDS; ++i)
+            m_words[i] = 0;
+    }
+
+    TinyRunNextSlot(const TinyRunNextSlot&) = delete;
+    TinyRunNextSlot& operator=(const TinyRunNextSlot&) = delete;
+
+    // Owner only. Returns FULL if the slot held an element, it is moved to displaced.
+    TinyDequeStatus put(const T& src, T* displaced)
+    {
+        const TinyDequeStatus sts = take(displaced) == TinyDequeStatus::SUCCESS ? TinyDequeStatus::FULL : TinyDequeStatus::SUCCESS;
+
+        // Only the owner makes the version odd, no thief touches the words before it is published
+        const uint64_t v = m_version.load(std::memory_order_relaxed);
+        store(src);
+        m_version.store(v + 1, std::memory_order_release);
+        return sts;
+    }
+
+    // Owner only
+    TinyDequeStatus take(T* dst)
+    {
+        uint64_t v = m_version.load(std::memory_order_relaxed);
+        if ((v & 1) == 0)
+            return TinyDequeStatus::EMPTY;
+
+        load(dst);
+        if (!m_version.compare_exchange_strong(v, v + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            return TinyDequeStatus::EMPTY; // a thief was faster
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Any thread. Only steals the element of expected_version, see version().
+    TinyDequeStatus steal(T* dst, uint64_t expected_version)
+    {
+        uint64_t v = m_version.load(std::memory_order_acquire);
+        if ((v & 1) == 0)
+            return TinyDequeStatus::EMPTY;
+        if (v != expected_version)
+            return TinyDequeStatus::ABORT;
+
+        T element;
+        load(&element);
+        if (!m_version.compare_exchange_strong(v, v + 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+            return TinyDequeStatus::ABORT;
+
+        *dst = element;
+        return TinyDequeStatus::SUCCESS;
+    }
+
+    // Any thread, odd while there is an element
+    uint64_t version() const
+    {
+        return m_version.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+        return (version() & 1) == 0;
+    }
+
+private:
+    static const int64_t WORDS = (sizeof(T) + sizeof(uintptr_t) - 1) / sizeof(uintptr_t);
+
+    void store(const T& src)
+    {
+        uintptr_t words[WORDS] = {};
+        memcpy(words, &src, sizeof(T));
+        for (int64_t i = 0; i < WORDS; ++i)
+            m_words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    void load(T* dst) const
+    {
+        uintptr_t words[WORDS];
+        for (int64_t i = 0; i < WORDS; ++i)
+            words[i] = m_words[i].load(std::memory_order_relaxed);
+        memcpy(dst, words, sizeof(T));
+    }
+
+    std::atomic<uint64_t> m_version;
+    std::atomic<uintptr_t> m_words[WORDS];
+};
+} // namespace utils
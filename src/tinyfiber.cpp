@@ -25,56 +25,1022 @@ SOFTWARE.
 #include "tinyfiber.h"
 
 #include "tinyringbuffer.hpp"
+#include "tinydeque.hpp"
+#include "tinylock.hpp"
+#include "tinytopology.hpp"
 
 #include <thread>
 #include <vector>
 #include <algorithm>
+#include <chrono>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
 
+#ifdef _WIN32
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #define VC_EXTRALEAN
 #include <Windows.h>
-#include <synchapi.h>
-
+#else
+#include "tinycontext.hpp"
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#define TFB_NOINLINE __declspec(noinline)
+#define TFB_MAY_ALIAS
+#else
+#define TFB_NOINLINE __attribute__((noinline))
+#define TFB_MAY_ALIAS __attribute__((may_alias))
+#endif
+
+#ifndef _WIN32
+using utils::TinyContext;
+#endif
+using utils::TinyDequeStatus;
+using utils::TinyLock;
 using utils::TinyRingBuffer;
+using utils::TinyRingBufferMode;
 using utils::TinyRingBufferStatus;
+using utils::TinyRunNextSlot;
+using utils::TinyWorkStealingDeque;
 
 const int TFB_DEFAULT_STACKSIZE = 0;
-const int TFB_MAX_NUMBER_OF_THREADS = 32;
-const int TFB_NUMBER_OF_FIBERS = 1024;
-const int TFB_FIBER_POOL_SIZE = 64 * 1024;
-const int TFB_JOB_QUEUE_SIZE = 64 * 1024;
+const int TFB_MAX_NUMBER_OF_FIBERS = 16 * 1024;
+const int TFB_FIBER_GROW_CHUNK = 16;
+const int TFB_MAX_IDLE_FIBERS = 1024;
+const int TFB_RESIDENT_IDLE_FIBERS = 64;
+const int TFB_JOB_QUEUE_SIZE = 128 * 1024; // bytes, per NUMA node
+const int TFB_WORKER_DEQUE_SIZE = 4 * 1024;
+const int TFB_MAX_JOB_BATCH = 32;
+static_assert(TFB_MAX_JOB_BATCH < TFB_WORKER_DEQUE_SIZE, "a batch must fit in an empty worker deque");
+const int TFB_PRIORITY_QUEUE_SIZE = 4 * 1024;
+const int TFB_LOW_PRIORITY_INTERVAL = 32;
+const int TFB_PARK_IDLE_MS = 100;
+const int TFB_IDLE_SPIN_COUNT = 1024;
+const int TFB_IDLE_YIELD_COUNT = 16;
+const int TFB_UNPARK_PENDING_JOBS = 4; // per active worker, more pending jobs than this unparks a worker
+
+// Same as the default stack reservation of a Windows fiber
+const size_t TFB_PLATFORM_DEFAULT_STACKSIZE = 1024 * 1024;
+const size_t TFB_DEFAULT_STACK_SIZES[TFB_NUMBER_OF_STACK_CLASSES] = {TFB_PLATFORM_DEFAULT_STACKSIZE, 16 * 1024, 64 * 1024};
+const size_t TFB_STACK_GRANULARITY = 4 * 1024;
+const size_t TFB_STACK_USAGE_BUCKET_SIZE = 256;
+const int TFB_STACK_USAGE_BUCKETS = 4096; // deeper usage lands in the last bucket
+
+#ifndef _WIN32
+// Worker threads handle SIGSEGV on this stack, the fiber stack may be exhausted
+const size_t TFB_SIGNAL_STACKSIZE = 64 * 1024;
+// Pattern of unused stack when stack usage is tracked
+const uint64_t TFB_STACK_PAINT = 0xfdfdfdfdfdfdfdfdull;
+// Inaccessible pages below each fiber stack. Frames larger than this may jump over it, build
+// with -fstack-clash-protection to catch those as well.
+const size_t TFB_STACK_GUARD_SIZE = 16 * 1024;
+#ifndef TINYCONTEXT_ASM
+// The saved stack pointer is hidden in the ucontext, keep this much of the top when trimming
+const size_t TFB_UCONTEXT_STACK_IN_USE = 16 * 1024;
+#endif
+#endif
 
-struct TfbContext
+namespace
+{
+struct TfbFiber
+{
+#ifdef _WIN32
+    void* handle;
+#else
+    TinyContext context;
+    void* stack; // lowest usable address, the guard pages are right below
+#endif
+    size_t stack_size;
+    void (*func)(void*);
+    void* param;
+    int stack_class;
+    void (*job_func)(void*); // job running on this fiber, for stack overflow reports
+};
+
+// Stack usage histogram of one job function
+struct TfbStackUsageRecord
+{
+    int64_t calls = 0;
+    size_t max_stack_usage = 0;
+    std::vector<int64_t> buckets = std::vector<int64_t>(TFB_STACK_USAGE_BUCKETS);
+};
+
+// Each worker thread owns a deque it pushes spawned jobs to and pops from (LIFO), idle workers steal from
+// the other end (FIFO). Jobs from threads outside the fiber system, jobs for another NUMA node and deque overflow
+// go to the job_queue of the node.
+// The most recently spawned job waits in run_next in front of the deque, it runs next on the same core
+// unless it is left there for longer than a steal attempt. High and low priority jobs skip all of this,
+// they go to shared queues.
+struct alignas(64) TfbWorker
+{
+    std::thread thread;
+    TinyWorkStealingDeque<TfbJobDeclaration> job_deque;
+    TinyRunNextSlot<TfbJobDeclaration> run_next;
+    uint32_t random_state;
+    int jobs_since_low_priority = 0;
+    int cpu = -1; // pinned to, -1 if the OS decides
+    int node = 0; // index into TfbContext::nodes
+
+    // Only written by the worker itself
+    std::atomic_int64_t spin_wakeups{0};
+    std::atomic_int64_t yield_wakeups{0};
+    std::atomic_int64_t sleeps{0};
+
+    // Thief side, the run_next slot we saw a job in at our last steal attempt
+    TfbWorker* seen_run_next = nullptr;
+    uint64_t seen_run_next_version = 0;
+};
+
+// Fibers may resume on another thread after a switch. The compiler must not cache the address
+// of thread local variables over a switch, that is why it is only accessed through thread_state().
+// MSVC also has /GT for this.
+struct TfbThreadState
+{
+    TfbContext* fiber_system;
+    TfbFiber* current_fiber;
+    TfbFiber* worker_fiber;
+    TfbFiber* finished_fiber;
+    TinyLock* wait_handle_lock;
+    TfbWorker* worker;
+    TfbJobDeclaration handoff_job; // dequeued job passed on to a fiber with a larger stack, or kept at max_fibers
+    int stack_class_hint;          // class of the last job dequeued on this thread
+#ifndef _WIN32
+    void* signal_stack;
+#endif
+};
+
+thread_local TfbThreadState l_thread_state;
+
+TFB_NOINLINE TfbThreadState& thread_state()
+{
+    TfbThreadState* ts = &l_thread_state;
+#ifndef _MSC_VER
+    asm volatile("" : "+r"(ts));
+#endif
+    return *ts;
+}
+
+#ifdef _WIN32
+void __stdcall fiber_entry(void* param)
+{
+    TfbFiber* fiber = (TfbFiber*)param;
+    fiber->func(fiber->param);
+}
+#else
+void fiber_entry(void* param)
+{
+    TfbFiber* fiber = (TfbFiber*)param;
+    fiber->func(fiber->param);
+    abort(); // fiber functions never return
+}
+#endif
+
+#ifndef _WIN32
+size_t page_size()
+{
+    static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+size_t guard_size()
+{
+    static const size_t size = std::max(page_size(), TFB_STACK_GUARD_SIZE);
+    return size;
+}
+#endif
+
+// Stacks get guard pages below them, an overflow faults instead of corrupting the neighbouring stack
+TfbFiber* create_fiber(size_t stack_size, void (*func)(void*), void* param, bool paint_stack = false)
+{
+    TfbFiber* fiber = new TfbFiber();
+    fiber->func = func;
+    fiber->param = param;
+
+#ifdef _WIN32
+    // Windows fiber stacks have guard pages already
+    fiber->handle = CreateFiberEx(0, stack_size, 0, fiber_entry, fiber);
+    if (fiber->handle == nullptr)
+    {
+        delete fiber;
+        return nullptr;
+    }
+    fiber->stack_size = stack_size;
+#else
+    (void)paint_stack;
+    if (stack_size == 0)
+        stack_size = TFB_PLATFORM_DEFAULT_STACKSIZE;
+
+    stack_size = (stack_size + page_size() - 1) & ~(page_size() - 1);
+
+    const size_t mapping_size = guard_size() + stack_size;
+    char* mapping = (char*)mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        delete fiber;
+        return nullptr;
+    }
+
+    if (mprotect(mapping, guard_size(), PROT_NONE) != 0)
+    {
+        munmap(mapping, mapping_size);
+        delete fiber;
+        return nullptr;
+    }
+
+    fiber->stack = mapping + guard_size();
+    fiber->stack_size = stack_size;
+    if (paint_stack)
+        std::fill((uint64_t*)fiber->stack, (uint64_t*)(mapping + mapping_size), TFB_STACK_PAINT);
+    utils::tiny_context_make(&fiber->context, fiber->stack, stack_size, fiber_entry, fiber);
+#endif
+    return fiber;
+}
+
+void delete_fiber(TfbFiber* fiber)
+{
+#ifdef _WIN32
+    DeleteFiber(fiber->handle);
+#else
+    munmap((char*)fiber->stack - guard_size(), guard_size() + fiber->stack_size);
+#endif
+    delete fiber;
+}
+
+// Async signal safe formatting of the overflow report
+char* append_text(char* out, const char* text)
+{
+    while (*text != '\0')
+        *out++ = *text++;
+    return out;
+}
+
+char* append_hex(char* out, uintptr_t value)
+{
+    char digits[2 * sizeof(value)];
+    int n = 0;
+    do
+    {
+        digits[n++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value != 0);
+
+    out = append_text(out, "0x");
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+char* append_dec(char* out, uint64_t value)
+{
+    char digits[20];
+    int n = 0;
+    do
+    {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+size_t format_stack_overflow(char* out, const TfbFiber* fiber)
+{
+    char* end = append_text(out, "tinyfiber: stack overflow in job ");
+    end = append_hex(end, (uintptr_t)fiber->job_func);
+    end = append_text(end, ", fiber stack is ");
+    end = append_dec(end, fiber->stack_size);
+    end = append_text(end, " bytes\n");
+    return (size_t)(end - out);
+}
+
+#ifdef _WIN32
+LONG CALLBACK stack_overflow_handler(EXCEPTION_POINTERS* exception)
+{
+    const TfbFiber* fiber = thread_state().current_fiber;
+    if (exception->ExceptionRecord->ExceptionCode == EXCEPTION_STACK_OVERFLOW && fiber != nullptr && fiber->job_func != nullptr)
+    {
+        char report[128];
+        DWORD written;
+        WriteFile(GetStdHandle(STD_ERROR_HANDLE), report, (DWORD)format_stack_overflow(report, fiber), &written, nullptr);
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+void install_stack_overflow_handler()
+{
+    static PVOID handler = AddVectoredExceptionHandler(1, stack_overflow_handler);
+    (void)handler;
+}
+#else
+struct sigaction l_previous_segv_action;
+
+void stack_overflow_handler(int sig, siginfo_t* info, void* ucontext)
+{
+    const TfbFiber* fiber = thread_state().current_fiber;
+    const char* fault = (const char*)info->si_addr;
+    if (fiber != nullptr && fiber->stack != nullptr && fault < (const char*)fiber->stack && fault >= (const char*)fiber->stack - guard_size())
+    {
+        char report[128];
+        const ssize_t written = write(STDERR_FILENO, report, format_stack_overflow(report, fiber));
+        (void)written;
+        // Returning with the default action retries the access and terminates the process
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+
+    // Not ours
+    if (l_previous_segv_action.sa_flags & SA_SIGINFO)
+    {
+        l_previous_segv_action.sa_sigaction(sig, info, ucontext);
+    }
+    else if (l_previous_segv_action.sa_handler != SIG_DFL && l_previous_segv_action.sa_handler != SIG_IGN)
+    {
+        l_previous_segv_action.sa_handler(sig);
+    }
+    else
+    {
+        signal(SIGSEGV, SIG_DFL);
+    }
+}
+
+// Process wide, any previous handler is called for faults outside of the guard pages. Installed again
+// on each init in case someone replaced it since.
+void install_stack_overflow_handler()
+{
+    struct sigaction current = {};
+    if (sigaction(SIGSEGV, nullptr, &current) != 0)
+        return;
+
+    if ((current.sa_flags & SA_SIGINFO) && current.sa_sigaction == stack_overflow_handler)
+        return;
+
+    struct sigaction action = {};
+    action.sa_sigaction = stack_overflow_handler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    l_previous_segv_action = current;
+    sigaction(SIGSEGV, &action, nullptr);
+}
+#endif
+
+// Signal stacks are per thread, only worker threads run fibers
+void enable_signal_stack()
+{
+#ifndef _WIN32
+    void* stack = mmap(nullptr, TFB_SIGNAL_STACKSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED)
+        return;
+
+    stack_t ss = {};
+    ss.ss_sp = stack;
+    ss.ss_size = TFB_SIGNAL_STACKSIZE;
+    if (sigaltstack(&ss, nullptr) != 0)
+    {
+        munmap(stack, TFB_SIGNAL_STACKSIZE);
+        return;
+    }
+    thread_state().signal_stack = stack;
+#endif
+}
+
+void disable_signal_stack()
+{
+#ifndef _WIN32
+    TfbThreadState& ts = thread_state();
+    if (ts.signal_stack == nullptr)
+        return;
+
+    stack_t ss = {};
+    ss.ss_flags = SS_DISABLE;
+    sigaltstack(&ss, nullptr);
+    munmap(ts.signal_stack, TFB_SIGNAL_STACKSIZE);
+    ts.signal_stack = nullptr;
+#endif
+}
+
+// Gives the pages below the suspended frames of a fiber back to the OS, they read as zero when touched again.
+// MADV_FREE would be cheaper but the pages stay in RSS until there is memory pressure.
+void trim_stack(TfbFiber* fiber)
+{
+#ifdef _WIN32
+    (void)fiber; // the stack of a Windows fiber is not ours to discard
+#else
+#ifdef TINYCONTEXT_ASM
+    const uintptr_t in_use = (uintptr_t)fiber->context.sp;
+#else
+    const uintptr_t in_use = (uintptr_t)fiber->stack + fiber->stack_size - TFB_UCONTEXT_STACK_IN_USE;
+#endif
+    const uintptr_t end = in_use & ~(uintptr_t)(page_size() - 1);
+    if (end > (uintptr_t)fiber->stack)
+        madvise(fiber->stack, end - (uintptr_t)fiber->stack, MADV_DONTNEED);
+#endif
+}
+
+TfbFiber* convert_thread_to_fiber()
+{
+    TfbFiber* fiber = new TfbFiber();
+#ifdef _WIN32
+    fiber->handle = ConvertThreadToFiber(fiber);
+#endif
+    thread_state().current_fiber = fiber;
+    return fiber;
+}
+
+void convert_fiber_to_thread()
+{
+    TfbThreadState& ts = thread_state();
+#ifdef _WIN32
+    ConvertFiberToThread();
+#endif
+    delete ts.current_fiber;
+    ts.current_fiber = nullptr;
+}
+
+TfbFiber* get_current_fiber()
+{
+    return thread_state().current_fiber;
+}
+
+void switch_to_fiber(TfbFiber* fiber)
+{
+    TfbThreadState& ts = thread_state();
+    TfbFiber* from = ts.current_fiber;
+    ts.current_fiber = fiber;
+#ifdef _WIN32
+    (void)from;
+    SwitchToFiber(fiber->handle);
+#else
+    utils::tiny_context_switch(&from->context, &fiber->context);
+#endif
+}
+} // namespace
+
+// Workers on one NUMA node and the jobs queued for them. Unpinned workers all belong to the first node.
+struct TfbNode
 {
     TinyRingBuffer<TfbJobDeclaration> job_queue;
-    TinyRingBuffer<void*> fiber_pool;
-    std::condition_variable no_job_cv;
-    std::thread worker_threads[TFB_MAX_NUMBER_OF_THREADS];
+    int os_node = 0;
+    int no_of_workers = 0;
+    std::atomic_int active_workers{0}; // not parked, changed under TfbContext::no_job_mx
+};
+
+struct TfbContext
+{
+    std::unique_ptr<TfbNode[]> nodes;
+    int no_of_nodes = 0;
+    std::vector<int> node_of_cpu; // index into nodes by logical CPU, for submitters outside the fiber system
+    TinyRingBuffer<TfbJobDeclaration, TinyRingBufferMode::MPMC> high_priority_queue;
+    TinyRingBuffer<TfbJobDeclaration, TinyRingBufferMode::MPMC> low_priority_queue;
+    TinyRingBuffer<TfbFiber*, TinyRingBufferMode::MPMC> fiber_pools[TFB_NUMBER_OF_STACK_CLASSES];
+    std::unique_ptr<char[]> worker_memory; // with room to align workers to a cache line
+    TfbWorker* workers = nullptr;
     int no_of_worker_threads = 0;
     std::atomic_bool should_exit;
-    std::mutex pending_jobs_mx;
     std::atomic_int64_t no_of_pending_jobs;
-    std::atomic<void*> main_fiber;
-    void* init_fibers_fiber = nullptr;
 
-    static thread_local void* l_worker_fiber;
-    static thread_local void* l_finished_fiber;
-    static thread_local PSRWLOCK l_wait_handle_lock;
-};
+    // Parking of idle workers. Only touched by submitters when a worker is actually sleeping.
+    std::mutex no_job_mx;
+    std::condition_variable no_job_cv;
+    std::atomic_int no_of_sleeping_workers;
+
+    // While more than target_workers are active, the surplus parks on park_cv at their next idle moment.
+    // Both are changed under no_job_mx.
+    std::atomic_int active_workers;
+    std::atomic_int target_workers;
+    std::condition_variable park_cv;
+
+    // Idle workers spinning for work, at most max_spinning_workers do at once
+    std::atomic_int no_of_spinning_workers;
+    int max_spinning_workers = 0;
+    std::atomic<TfbFiber*> main_fiber;
+    TfbFiber* init_fibers_fiber = nullptr;
+    std::atomic_int no_of_fibers; // created so far, pooled or running
+    TfbInitDeclaration config;     // with defaults filled in
+
+    std::mutex stack_usage_mx;
+    std::unordered_map<void (*)(void*), TfbStackUsageRecord> stack_usage;
+
+    // The MPMC queues are cache line aligned, new does not guarantee that for over-aligned types before C++17
+    static void* operator new(size_t size)
+    {
+#ifdef _WIN32
+        void* memory = _aligned_malloc(size, alignof(TfbContext));
+#else
+        void* memory = nullptr;
+        if (posix_memalign(&memory, alignof(TfbContext), size) != 0)
+            memory = nullptr;
+#endif
+        if (memory == nullptr)
+            throw std::bad_alloc();
+        return memory;
+    }
 
-thread_local void* TfbContext::l_worker_fiber;
-thread_local void* TfbContext::l_finished_fiber;
-thread_local PSRWLOCK TfbContext::l_wait_handle_lock;
+    static void operator delete(void* memory)
+    {
+#ifdef _WIN32
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+};
 
 namespace
 {
-thread_local TfbContext* l_my_fiber_system;
+// How the runtime sees the plain C memory of a TfbWaitHandle, zero is a valid state of every member. It may
+// alias the handle, so the optimizer does not reorder accesses through it with those of the C fields.
+struct TFB_MAY_ALIAS TfbWaitHandleState
+{
+    void* fiber;
+    std::atomic_int64_t counter;
+    TinyLock lock;
+};
+static_assert(offsetof(TfbWaitHandle, _counter) == sizeof(void*) && offsetof(TfbWaitHandle, _lock) == sizeof(void*) + sizeof(int64_t),
+              "TfbWaitHandle does not match TfbWaitHandleState");
+static_assert(sizeof(TfbWaitHandleState) <= sizeof(TfbWaitHandle), "TfbWaitHandle is too small");
+static_assert(alignof(TfbWaitHandleState) <= alignof(TfbWaitHandle), "TfbWaitHandle is not aligned enough");
+
+TfbWaitHandleState& wait_handle_state(TfbWaitHandle* wait_handle)
+{
+    return *reinterpret_cast<TfbWaitHandleState*>(wait_handle);
+}
+
+TinyLock& wait_handle_lock(TfbWaitHandle* wait_handle)
+{
+    return wait_handle_state(wait_handle).lock;
+}
+
+std::atomic_int64_t& wait_handle_counter(TfbWaitHandle* wait_handle)
+{
+    return wait_handle_state(wait_handle).counter;
+}
+
+TfbContext* my_fiber_system()
+{
+    return thread_state().fiber_system;
+}
+
+// Spin wait hint, leaves the core to the other hyperthread
+inline void cpu_relax()
+{
+#ifdef _WIN32
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+bool surplus_worker(const TfbContext& fs)
+{
+    return fs.active_workers.load(std::memory_order_relaxed) > fs.target_workers.load(std::memory_order_relaxed);
+}
+
+// Auto scaling, every active worker is busy and jobs queue up
+void unpark_worker(TfbContext& fs)
+{
+    const int target = fs.target_workers.load(std::memory_order_relaxed);
+    if (target >= fs.no_of_worker_threads || fs.no_of_pending_jobs.load() <= (int64_t)target * TFB_UNPARK_PENDING_JOBS)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lk(fs.no_job_mx);
+        if (fs.target_workers != target)
+            return;
+        fs.target_workers = target + 1;
+    }
+    fs.park_cv.notify_one();
+}
+
+// Must be called after no_of_pending_jobs is increased. Both are sequentially consistent, so either we
+// see the sleeper or the sleeper sees the new job when it checks its predicate.
+void wake_workers(TfbContext& fs, int64_t jobs)
+{
+    if (fs.no_of_sleeping_workers.load() == 0)
+    {
+        if (fs.config.auto_scale_workers)
+            unpark_worker(fs);
+        return;
+    }
+
+    {
+        // Sleeper is either before its predicate check or waiting
+        std::lock_guard<std::mutex> lk(fs.no_job_mx);
+    }
+
+    // One sleeper could be on a node that may not steal the job
+    if (jobs == 1 && fs.no_of_nodes == 1)
+        fs.no_job_cv.notify_one();
+    else
+        fs.no_job_cv.notify_all();
+}
+
+// xorshift32, only used to pick steal victims
+uint32_t next_random(TfbWorker& worker)
+{
+    uint32_t x = worker.random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    worker.random_state = x;
+    return x;
+}
+
+bool valid_job(const TfbJobDeclaration& job)
+{
+    return job.stack_class >= 0 && job.stack_class < TFB_NUMBER_OF_STACK_CLASSES && job.priority >= 0 &&
+           job.priority < TFB_NUMBER_OF_PRIORITIES && job.node >= 0;
+}
+
+// The hinted node if it has workers, otherwise the node of the submitter
+int node_for_job(const TfbContext& fs, const TfbWorker* submitter, const TfbJobDeclaration& job)
+{
+    if (job.node > 0)
+    {
+        for (int i = 0; i < fs.no_of_nodes; ++i)
+        {
+            if (fs.nodes[i].os_node == job.node - 1)
+                return i;
+        }
+    }
+
+    if (submitter != nullptr)
+        return submitter->node;
+    if (fs.no_of_nodes == 1)
+        return 0;
+
+    const int cpu = utils::tiny_topology_current_cpu();
+    return cpu >= 0 && cpu < (int)fs.node_of_cpu.size() ? fs.node_of_cpu[cpu] : 0;
+}
+
+bool push_job(TfbContext& fs, const TfbJobDeclaration& job)
+{
+    if (job.priority == TFB_PRIORITY_HIGH)
+        return fs.high_priority_queue.enqueue(job) == TinyRingBufferStatus::SUCCESS;
+    if (job.priority == TFB_PRIORITY_LOW)
+        return fs.low_priority_queue.enqueue(job) == TinyRingBufferStatus::SUCCESS;
+
+    TfbThreadState& ts = thread_state();
+    TfbWorker* submitter = ts.fiber_system == &fs ? ts.worker : nullptr;
+    const int node = node_for_job(fs, submitter, job);
+    if (submitter == nullptr || submitter->node != node)
+        return fs.nodes[node].job_queue.enqueue(job) == TinyRingBufferStatus::SUCCESS;
+
+    // The job in run_next makes room for the new one, it goes to the deque or overflows to the job_queue
+    TfbWorker& worker = *submitter;
+    TfbJobDeclaration previous;
+    if (worker.run_next.take(&previous) == TinyDequeStatus::SUCCESS && worker.job_deque.push(previous) != TinyDequeStatus::SUCCESS &&
+        fs.nodes[node].job_queue.enqueue(previous) != TinyRingBufferStatus::SUCCESS)
+    {
+        worker.run_next.put(previous, &previous);
+        return false;
+    }
+
+    worker.run_next.put(job, &previous); // empty, nothing displaced
+    return true;
+}
+
+// Tries the deques of the workers on the thief's node, or of the workers on all other nodes
+bool steal_from_deques(TfbContext& fs, TfbWorker& thief, int start, bool same_node, TfbJobDeclaration* job)
+{
+    const int n = fs.no_of_worker_threads;
+    for (int i = 0; i < n; ++i)
+    {
+        TfbWorker& victim = fs.workers[(start + i) % n];
+        if (&victim == &thief || (victim.node == thief.node) != same_node)
+            continue;
+
+        TinyDequeStatus sts;
+        do
+        {
+            sts = victim.job_deque.steal(job);
+        } while (sts == TinyDequeStatus::ABORT);
+
+        if (sts == TinyDequeStatus::SUCCESS)
+            return true;
+    }
+    return false;
+}
+
+// Local work first. A remote node gives up queued jobs only when it has more than its active workers can pick
+// up, and before jobs its workers have taken already. A node whose workers are all parked gives up every job.
+bool steal_job(TfbContext& fs, TfbWorker& thief, TfbJobDeclaration* job)
+{
+    const int n = fs.no_of_worker_threads;
+    const int start = (int)(next_random(thief) % (uint32_t)n);
+    if (steal_from_deques(fs, thief, start, true, job))
+        return true;
+
+    if (fs.no_of_nodes > 1)
+    {
+        for (int i = 1; i < fs.no_of_nodes; ++i)
+        {
+            TfbNode& remote = fs.nodes[(thief.node + i) % fs.no_of_nodes];
+            if (remote.job_queue.count() > remote.active_workers.load(std::memory_order_relaxed) &&
+                remote.job_queue.dequeue(job) == TinyRingBufferStatus::SUCCESS)
+                return true;
+        }
+
+        if (steal_from_deques(fs, thief, start, false, job))
+            return true;
+    }
+
+    // Only run_next jobs left. Take the one we saw last time if it is still there, otherwise remember one.
+    if (thief.seen_run_next != nullptr)
+    {
+        TfbWorker& victim = *thief.seen_run_next;
+        thief.seen_run_next = nullptr;
+        if (victim.run_next.steal(job, thief.seen_run_next_version) == TinyDequeStatus::SUCCESS)
+            return true;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        TfbWorker& victim = fs.workers[(start + i) % n];
+        const uint64_t version = victim.run_next.version();
+        if (&victim != &thief && (version & 1) != 0)
+        {
+            thief.seen_run_next = &victim;
+            thief.seen_run_next_version = version;
+            break;
+        }
+    }
+    return false;
+}
+
+// Takes a share of the job_queue of our node in one operation. The first job is returned, the rest go to
+// the bottom of our own deque where other workers still can steal them. Only called with an empty deque.
+bool take_job_batch(TfbContext& fs, TfbWorker& worker, TfbJobDeclaration* job)
+{
+    TfbNode& node = fs.nodes[worker.node];
+    if (node.job_queue.empty())
+        return false;
+
+    const int64_t share = node.job_queue.count() / node.no_of_workers;
+    const int64_t batch_size = std::max<int64_t>(1, std::min<int64_t>(share, TFB_MAX_JOB_BATCH));
+
+    TfbJobDeclaration batch[TFB_MAX_JOB_BATCH];
+    int64_t dequeued = 0;
+    if (node.job_queue.dequeue_up_to(batch, batch_size, &dequeued) != TinyRingBufferStatus::SUCCESS)
+        return false;
+
+    // Push in reverse so our own LIFO pops keep the submission order. Only we push to our deque, it was
+    // empty and is larger than a batch, so the pushes can not fail.
+    for (int64_t i = dequeued - 1; i > 0; --i)
+    {
+        const TinyDequeStatus sts = worker.job_deque.push(batch[i]);
+        assert(sts == TinyDequeStatus::SUCCESS);
+        (void)sts;
+    }
+    *job = batch[0];
+    return true;
+}
+
+// Only called by fibers running on a worker thread of fs
+bool dequeue_job(TfbContext& fs, TfbJobDeclaration* job)
+{
+    if (fs.high_priority_queue.dequeue(job) == TinyRingBufferStatus::SUCCESS)
+        return true;
+
+    TfbWorker& worker = *thread_state().worker;
+    if (++worker.jobs_since_low_priority >= TFB_LOW_PRIORITY_INTERVAL)
+    {
+        worker.jobs_since_low_priority = 0;
+        if (fs.low_priority_queue.dequeue(job) == TinyRingBufferStatus::SUCCESS)
+            return true;
+    }
+
+    if (worker.run_next.take(job) == TinyDequeStatus::SUCCESS || worker.job_deque.pop(job) == TinyDequeStatus::SUCCESS)
+        return true;
+
+    if (take_job_batch(fs, worker, job) || steal_job(fs, worker, job))
+        return true;
+
+    return fs.low_priority_queue.dequeue(job) == TinyRingBufferStatus::SUCCESS;
+}
+
+void fiber_main_loop(void* fiber_system);
+
+// Counts up to count new fibers against max_fibers, returns how many fit
+int reserve_fibers(TfbContext& fs, int count)
+{
+    const int before = fs.no_of_fibers.fetch_add(count);
+    const int granted = std::min(count, fs.config.max_fibers - before);
+    if (granted < count)
+        fs.no_of_fibers -= count - std::max(granted, 0);
+    return std::max(granted, 0);
+}
+
+// All stack classes share max_fibers. Deletes up to count idle fibers of the other classes to make room.
+int delete_idle_fibers(TfbContext& fs, int keep_class, int count)
+{
+    int deleted = 0;
+    for (int stack_class = 0; stack_class < TFB_NUMBER_OF_STACK_CLASSES; ++stack_class)
+    {
+        TfbFiber* fiber;
+        while (stack_class != keep_class && deleted < count && fs.fiber_pools[stack_class].dequeue(&fiber) == TinyRingBufferStatus::SUCCESS)
+        {
+            delete_fiber(fiber);
+            fs.no_of_fibers--;
+            ++deleted;
+        }
+    }
+    return deleted;
+}
+
+// Reuses a pooled fiber of the stack class. When the pool is dry it grows by a chunk, as long as we stay below
+// max_fibers. At the ceiling idle fibers of other classes give way.
+TfbFiber* acquire_fiber(TfbContext& fs, int stack_class)
+{
+    TfbFiber* fiber;
+    if (fs.fiber_pools[stack_class].dequeue(&fiber) == TinyRingBufferStatus::SUCCESS)
+        return fiber;
+
+    const int chunk = fs.config.fiber_grow_chunk;
+    int granted = reserve_fibers(fs, chunk);
+    if (granted <= 0 && delete_idle_fibers(fs, stack_class, chunk) > 0)
+        granted = reserve_fibers(fs, chunk);
+    if (granted <= 0)
+        return nullptr;
+
+    fiber = nullptr;
+    for (int i = 0; i < granted; ++i)
+    {
+        TfbFiber* created = create_fiber(fs.config.stack_sizes[stack_class], fiber_main_loop, &fs, fs.config.track_stack_usage != 0);
+        if (created == nullptr)
+        {
+            fs.no_of_fibers -= granted - i;
+            break;
+        }
+        created->stack_class = stack_class;
+
+        if (fiber == nullptr)
+        {
+            fiber = created;
+        }
+        else if (fs.fiber_pools[stack_class].enqueue(created) != TinyRingBufferStatus::SUCCESS)
+        {
+            // Others filled the pool meanwhile, it holds enough spares
+            delete_fiber(created);
+            fs.no_of_fibers--;
+        }
+    }
+    return fiber;
+}
+
+// Returns a fiber that has switched away for good to the pool, or deletes it if there are
+// already max_idle_fibers idle fibers of its stack class. Stacks of fibers beyond resident_idle_fibers
+// are trimmed.
+void release_fiber(TfbContext& fs, TfbFiber* fiber)
+{
+    auto& pool = fs.fiber_pools[fiber->stack_class];
+    const int64_t idle = pool.count();
+    if (idle < fs.config.max_idle_fibers)
+    {
+        // Painted stacks must stay painted
+        if (fs.config.resident_idle_fibers >= 0 && idle >= fs.config.resident_idle_fibers && !fs.config.track_stack_usage)
+            trim_stack(fiber);
+
+        if (pool.enqueue(fiber) == TinyRingBufferStatus::SUCCESS)
+            return;
+    }
+
+    delete_fiber(fiber);
+    fs.no_of_fibers--;
+}
+
+#ifndef _WIN32
+// Paints from the lowest touched word up to a margin below our own frame, everything below the
+// stack pointer is dead
+TFB_NOINLINE void repaint_stack(uint64_t* lowest_touched)
+{
+    volatile char marker = 0;
+    uint64_t* end = (uint64_t*)(((uintptr_t)&marker - 512) & ~(uintptr_t)7);
+    for (volatile uint64_t* p = lowest_touched; p < end; ++p)
+        *p = TFB_STACK_PAINT;
+}
+#endif
+
+#ifndef _WIN32
+uint64_t* lowest_touched_word(TfbFiber* fiber)
+{
+    uint64_t* p = (uint64_t*)fiber->stack;
+    uint64_t* top = (uint64_t*)((char*)fiber->stack + fiber->stack_size);
+    while (p < top && *p == TFB_STACK_PAINT)
+        ++p;
+    return p;
+}
+
+void add_stack_usage(TfbContext& fs, void (*func)(void*), size_t usage)
+{
+    std::lock_guard<std::mutex> lk(fs.stack_usage_mx);
+    TfbStackUsageRecord& record = fs.stack_usage[func];
+    record.calls++;
+    record.max_stack_usage = std::max(record.max_stack_usage, usage);
+    const size_t bucket = std::min(usage / TFB_STACK_USAGE_BUCKET_SIZE, (size_t)TFB_STACK_USAGE_BUCKETS - 1);
+    record.buckets[bucket]++;
+}
+#endif
+
+// Called on the fiber that just ran func to the end
+void record_stack_usage(TfbContext& fs, TfbFiber* fiber, void (*func)(void*))
+{
+#ifdef _WIN32
+    (void)fs;
+    (void)fiber;
+    (void)func;
+#else
+    uint64_t* lowest = lowest_touched_word(fiber);
+    const size_t usage = (size_t)((char*)fiber->stack + fiber->stack_size - (char*)lowest);
+    repaint_stack(lowest);
+    add_stack_usage(fs, func, usage);
+#endif
+}
+
+// Runs a job on top of the current fiber's stack, for run_inline and tfb_add_and_run_ext. Its usage
+// counts from our frame down. The outer job keeps the depth it reached, it is not done yet.
+TFB_NOINLINE void run_job_inline(TfbContext& fs, void (*func)(void*), void* user_data)
+{
+    // The job may await and resume on another thread, but we stay on this fiber
+    TfbFiber* fiber = get_current_fiber();
+    void (*outer_job_func)(void*) = fiber->job_func;
+    fiber->job_func = func;
+
+#ifdef _WIN32
+    (void)fs;
+    func(user_data);
+#else
+    if (!fs.config.track_stack_usage || fiber->stack == nullptr)
+    {
+        func(user_data);
+    }
+    else
+    {
+        volatile char marker = 0;
+        uint64_t* outer_lowest = lowest_touched_word(fiber);
+        repaint_stack(outer_lowest);
+        func(user_data);
+        uint64_t* lowest = lowest_touched_word(fiber);
+        add_stack_usage(fs, func, (size_t)((char*)&marker - (char*)lowest));
+
+        // The scan stops at the first word that is not paint
+        if (outer_lowest < lowest)
+            *outer_lowest = ~TFB_STACK_PAINT;
+    }
+#endif
+
+    fiber->job_func = outer_job_func;
+}
+
+size_t stack_usage_percentile(const TfbStackUsageRecord& record, int64_t percent)
+{
+    const int64_t rank = (record.calls * percent + 99) / 100;
+    int64_t seen = 0;
+    for (int i = 0; i < TFB_STACK_USAGE_BUCKETS; ++i)
+    {
+        seen += record.buckets[i];
+        if (seen >= rank)
+            return std::min((i + 1) * TFB_STACK_USAGE_BUCKET_SIZE, record.max_stack_usage);
+    }
+    return record.max_stack_usage;
+}
 
-static void __stdcall fiber_main_loop(void* fiber_system)
+// Counts down the wait handle of a finished job. Returns the fiber awaiting it if this was the last job.
+TfbFiber* complete_job(TfbWaitHandle* wait_handle)
+{
+    if (wait_handle == nullptr)
+        return nullptr;
+
+    wait_handle_lock(wait_handle).lock();
+
+    wait_handle_counter(wait_handle)--;
+
+    TfbFiber* fiber = nullptr;
+    if (wait_handle_counter(wait_handle).load() == 0)
+    {
+        // A fiber may be waiting for us
+        fiber = (TfbFiber*)wait_handle->_fiber;
+        wait_handle->_fiber = nullptr;
+    }
+
+    wait_handle_lock(wait_handle).unlock(); // allow other jobs to await
+    return fiber;
+}
+
+void fiber_main_loop(void* fiber_system)
 {
     if (fiber_system == nullptr)
         return;
@@ -83,172 +1049,497 @@ static void __stdcall fiber_main_loop(void* fiber_system)
     while (true)
     {
         // allow to resume await fiber now, after we have switched from it
-        if (fs.l_wait_handle_lock != nullptr)
+        TfbThreadState& ts = thread_state();
+        if (ts.wait_handle_lock != nullptr)
         {
-            ReleaseSRWLockExclusive(fs.l_wait_handle_lock);
-            fs.l_wait_handle_lock = nullptr;
+            ts.wait_handle_lock->unlock();
+            ts.wait_handle_lock = nullptr;
         }
 
-        TfbJobDeclaration jb;
-        if (!fs.should_exit && fs.job_queue.dequeue(&jb) == TinyRingBufferStatus::SUCCESS)
+        // a fiber with a too small stack handed its job over to us
+        if (ts.finished_fiber != nullptr)
         {
-            {
-                std::lock_guard<std::mutex> lk(fs.pending_jobs_mx);
-                --fs.no_of_pending_jobs;
-            }
+            release_fiber(fs, ts.finished_fiber);
+            ts.finished_fiber = nullptr;
+        }
 
-            jb.func(jb.user_data);
-            fs.l_finished_fiber = GetCurrentFiber();
+        TfbJobDeclaration jb;
+        if (ts.handoff_job.func != nullptr)
+        {
+            jb = ts.handoff_job;
+            ts.handoff_job.func = nullptr;
+        }
+        else if (!fs.should_exit && !surplus_worker(fs) && dequeue_job(fs, &jb))
+        {
+            --fs.no_of_pending_jobs;
+            ts.stack_class_hint = jb.stack_class;
 
-            // Take care of waiting
-            if (jb.wait_handle != nullptr)
+            TfbFiber* self = get_current_fiber();
+            if (fs.config.stack_sizes[self->stack_class] < fs.config.stack_sizes[jb.stack_class])
             {
-                AcquireSRWLockExclusive((PSRWLOCK)&jb.wait_handle->_lock);
-
-                reinterpret_cast<std::atomic_int64_t&>(jb.wait_handle->_counter)--;
-
-                // if we are last and someone is waiting for us, yield to it
-                if (reinterpret_cast<std::atomic_int64_t&>(jb.wait_handle->_counter).load() == 0)
+                TfbFiber* fiber = acquire_fiber(fs, jb.stack_class);
+                if (fiber == nullptr)
                 {
-                    void* fiber = jb.wait_handle->_fiber;
-
-                    // A fiber is waiting for us
-                    if (fiber != nullptr)
-                    {
-                        jb.wait_handle->_fiber = nullptr;
-                        ReleaseSRWLockExclusive((PSRWLOCK)&jb.wait_handle->_lock); // allow other jobs to await
-                        SwitchToFiber(fiber);                                      // yield back to awaiter fiber, await will put us back at pool
-                    }
+                    // At max_fibers, put the job back and let the worker fiber wait for a release. If the queues
+                    // are full it stays with us, the worker fiber hands it to the next fiber it gets.
+                    if (push_job(fs, jb))
+                        ++fs.no_of_pending_jobs;
                     else
-                    {
-                        // No one is awaiting for us
-                        ReleaseSRWLockExclusive((PSRWLOCK)&jb.wait_handle->_lock);
-                    }
-                }
-                else
-                {
-                    // There may be more jobs for us
-                    ReleaseSRWLockExclusive((PSRWLOCK)&jb.wait_handle->_lock);
+                        ts.handoff_job = jb;
+                    ts.finished_fiber = self;
+                    switch_to_fiber(ts.worker_fiber);
+                    continue;
                 }
+
+                ts.handoff_job = jb;
+                ts.finished_fiber = self;
+                switch_to_fiber(fiber); // the new fiber puts us back at pool
+                continue;
             }
         }
         else
         {
             // There are no jobs for us or exit is requested, return to worker fiber whom can block us
-            fs.l_finished_fiber = GetCurrentFiber();
-            SwitchToFiber(fs.l_worker_fiber); // worker fiber will put us back to pool
+            ts.finished_fiber = get_current_fiber();
+            switch_to_fiber(ts.worker_fiber); // worker fiber will put us back to pool
+            continue;
+        }
+
+        get_current_fiber()->job_func = jb.func;
+        jb.func(jb.user_data);
+        if (fs.config.track_stack_usage)
+            record_stack_usage(fs, get_current_fiber(), jb.func);
+
+        // Take care of waiting, if we are last and someone is waiting for us, yield to it
+        TfbFiber* awaiter = complete_job(jb.wait_handle);
+        if (awaiter != nullptr)
+        {
+            thread_state().finished_fiber = get_current_fiber();
+            switch_to_fiber(awaiter); // yield back to awaiter fiber, await will put us back at pool
         }
     }
 }
 
-static int worker_function(TfbContext& fs)
+// Spins and then yields before an idle worker goes to sleep. Submitters do not need to wake a worker that is
+// still spinning, the next job is picked up without a trip through the OS. True if the wait is over.
+bool idle_wait(TfbContext& fs, TfbWorker& worker)
 {
-    while (!fs.should_exit)
+    auto wait_is_over = [&] { return fs.no_of_pending_jobs.load(std::memory_order_relaxed) > 0 || fs.should_exit || surplus_worker(fs); };
+    if (fs.no_of_spinning_workers.fetch_add(1) < fs.max_spinning_workers)
     {
-        if (fs.no_of_pending_jobs > 0)
+        for (int i = 0; i < fs.config.idle_spin_count; ++i)
         {
-            void* work_fiber;
-            TinyRingBufferStatus sts = fs.fiber_pool.dequeue(&work_fiber);
+            if (wait_is_over())
+            {
+                fs.no_of_spinning_workers--;
+                worker.spin_wakeups.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            cpu_relax();
+        }
+    }
+    fs.no_of_spinning_workers--;
+
+    for (int i = 0; i < fs.config.idle_yield_count; ++i)
+    {
+        if (wait_is_over())
+        {
+            worker.yield_wakeups.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
 
-            if (sts == TinyRingBufferStatus::SUCCESS)
+// Worker fibers never migrate, thread_state() is stable here
+int worker_function(TfbContext& fs)
+{
+    TfbThreadState& ts = thread_state();
+    while (!fs.should_exit)
+    {
+        if (surplus_worker(fs) && ts.handoff_job.func == nullptr)
+        {
+            // Jobs left in our deque are stolen by the active workers
+            std::unique_lock<std::mutex> lk(fs.no_job_mx);
+            if (fs.active_workers > fs.target_workers)
+            {
+                TfbNode& node = fs.nodes[ts.worker->node];
+                --fs.active_workers;
+                --node.active_workers;
+                fs.park_cv.wait(lk, [&] { return fs.active_workers < fs.target_workers || fs.should_exit; });
+                ++fs.active_workers;
+                ++node.active_workers;
+            }
+        }
+        else if (fs.no_of_pending_jobs > 0 || ts.handoff_job.func != nullptr)
+        {
+            TfbFiber* work_fiber = acquire_fiber(fs, ts.stack_class_hint);
+            if (work_fiber != nullptr)
             {
-                SwitchToFiber(work_fiber);
-                if (fs.l_finished_fiber != nullptr)
+                switch_to_fiber(work_fiber);
+                if (ts.finished_fiber != nullptr)
                 {
-                    fs.fiber_pool.enqueue(fs.l_finished_fiber);
-                    fs.l_finished_fiber = nullptr;
+                    release_fiber(fs, ts.finished_fiber);
+                    ts.finished_fiber = nullptr;
                 }
             }
             else
             {
-                return -1; // no more fibers in the pool
+                std::this_thread::yield(); // at max_fibers, wait for one to be released
             }
         }
-        else
+        else if (!idle_wait(fs, *ts.worker))
         {
-            std::unique_lock<std::mutex> lk(fs.pending_jobs_mx);
-            fs.no_job_cv.wait(lk, [&] { return fs.no_of_pending_jobs > 0 || fs.should_exit; });
+            // The sleeper count is published before the predicate is checked, pairs with wake_workers()
+            std::unique_lock<std::mutex> lk(fs.no_job_mx);
+            ++fs.no_of_sleeping_workers;
+            auto woken = [&] { return fs.no_of_pending_jobs > 0 || fs.should_exit || surplus_worker(fs); };
+            if (!woken())
+                ts.worker->sleeps.fetch_add(1, std::memory_order_relaxed);
+            if (!fs.config.auto_scale_workers)
+            {
+                fs.no_job_cv.wait(lk, woken);
+            }
+            else if (!fs.no_job_cv.wait_for(lk, std::chrono::milliseconds(fs.config.park_idle_ms), woken))
+            {
+                // Idle for a while, we park at the top of the loop
+                if (fs.active_workers == fs.target_workers && fs.target_workers > fs.config.min_active_workers)
+                    --fs.target_workers;
+            }
+            --fs.no_of_sleeping_workers;
         }
     }
     return 0;
 }
 
-static void __stdcall start_workers(void* fiber_system)
+// Stack left below the caller. Zero for fibers converted from threads on POSIX, we do not know their stack.
+TFB_NOINLINE size_t remaining_stack()
+{
+    volatile char marker = 0;
+#ifdef _WIN32
+    ULONG_PTR low;
+    ULONG_PTR high;
+    GetCurrentThreadStackLimits(&low, &high);
+    return (size_t)((uintptr_t)&marker - low);
+#else
+    const TfbFiber* fiber = get_current_fiber();
+    if (fiber == nullptr || fiber->stack == nullptr)
+        return 0;
+    return (size_t)((uintptr_t)&marker - (uintptr_t)fiber->stack);
+#endif
+}
+
+// Help first. Takes the jobs of wait_handle from our run_next slot and the bottom of our own deque and runs them on the
+// awaiting stack, as long as at least half of their stack class is left. Stops at the first job that
+// belongs to someone else, it goes back where it was.
+void run_inline(TfbContext& fs, TfbWaitHandle* wait_handle)
+{
+    TfbJobDeclaration jb;
+    while (wait_handle_counter(wait_handle).load() > 0)
+    {
+        TfbThreadState& ts = thread_state();
+        if (ts.worker == nullptr || ts.fiber_system != &fs)
+            return;
+
+        TfbWorker& worker = *ts.worker;
+        const bool from_run_next = worker.run_next.take(&jb) == TinyDequeStatus::SUCCESS;
+        if (!from_run_next && worker.job_deque.pop(&jb) != TinyDequeStatus::SUCCESS)
+            return;
+
+        if (jb.wait_handle != wait_handle || remaining_stack() < fs.config.stack_sizes[jb.stack_class] / 2)
+        {
+            // there is room, we just took it
+            if (from_run_next)
+                worker.run_next.put(jb, &jb);
+            else
+                worker.job_deque.push(jb);
+            return;
+        }
+
+        --fs.no_of_pending_jobs;
+
+        run_job_inline(fs, jb.func, jb.user_data);
+
+        // We are the awaiter and have not published our fiber yet, no one to resume
+        complete_job(jb.wait_handle);
+    }
+}
+
+// The number of workers is only known at init. Each worker gets its own cache lines, new[] does not
+// guarantee that for over-aligned types before C++17.
+void create_workers(TfbContext& fs, int count)
+{
+    size_t size = sizeof(TfbWorker) * count + alignof(TfbWorker);
+    fs.worker_memory.reset(new char[size]);
+    void* memory = fs.worker_memory.get();
+    fs.workers = (TfbWorker*)std::align(alignof(TfbWorker), sizeof(TfbWorker) * count, memory, size);
+    for (int i = 0; i < count; ++i)
+        new (&fs.workers[i]) TfbWorker();
+    fs.no_of_worker_threads = count;
+}
+
+void destroy_workers(TfbContext& fs)
+{
+    for (int i = 0; i < fs.no_of_worker_threads; ++i)
+    {
+        fs.workers[i].job_deque.free();
+        fs.workers[i].~TfbWorker();
+    }
+    fs.workers = nullptr;
+    fs.worker_memory.reset();
+    fs.no_of_worker_threads = 0;
+}
+
+// Deletes the context and its idle fibers, no worker may run
+void delete_context(TfbContext* fs)
+{
+    if (fs->init_fibers_fiber != nullptr)
+        delete_fiber(fs->init_fibers_fiber);
+    for (auto& pool : fs->fiber_pools)
+    {
+        TfbFiber* fiber;
+        while (!pool.empty() && pool.dequeue(&fiber) == TinyRingBufferStatus::SUCCESS) // may not be initialized
+            delete_fiber(fiber);
+        pool.free();
+    }
+    for (int i = 0; i < fs->no_of_nodes; ++i)
+        fs->nodes[i].job_queue.free();
+    fs->high_priority_queue.free();
+    fs->low_priority_queue.free();
+    destroy_workers(*fs);
+
+    delete fs;
+}
+
+void pin_worker(const TfbWorker& worker)
+{
+    if (worker.cpu >= 0)
+        utils::tiny_topology_pin_thread(worker.cpu);
+}
+
+void start_workers(void* fiber_system)
 {
     if (fiber_system == nullptr)
         return;
 
     TfbContext& fs = *(TfbContext*)fiber_system;
     // First worker will start at main fiber
-    fs.worker_threads[0] = std::thread([&fs] {
-        l_my_fiber_system = &fs;
-        fs.l_worker_fiber = ConvertThreadToFiber(nullptr);
-        SwitchToFiber(fs.main_fiber);
-        if (fs.l_finished_fiber != nullptr)
-            fs.fiber_pool.enqueue(fs.l_finished_fiber);
-        fs.l_finished_fiber = nullptr;
-        ConvertFiberToThread();
+    fs.workers[0].thread = std::thread([&fs] {
+        TfbThreadState& ts = thread_state();
+        ts.fiber_system = &fs;
+        ts.worker = &fs.workers[0];
+        pin_worker(*ts.worker);
+        ts.worker_fiber = convert_thread_to_fiber();
+        enable_signal_stack();
+        switch_to_fiber(fs.main_fiber);
+        if (ts.finished_fiber != nullptr)
+            release_fiber(fs, ts.finished_fiber);
+        ts.finished_fiber = nullptr;
+        // Main fiber has left this thread, continue as a normal worker
+        worker_function(fs); // todo(markusl): handle return error code
+        disable_signal_stack();
+        convert_fiber_to_thread();
     });
 
     // Other workers will start with worker_function
     for (int i = 1; i < fs.no_of_worker_threads; ++i)
     {
-        fs.worker_threads[i] = std::thread([&fs] {
-            l_my_fiber_system = &fs;
-            fs.l_worker_fiber = ConvertThreadToFiber(nullptr);
+        fs.workers[i].thread = std::thread([&fs, i] {
+            TfbThreadState& ts = thread_state();
+            ts.fiber_system = &fs;
+            ts.worker = &fs.workers[i];
+            pin_worker(*ts.worker);
+            ts.worker_fiber = convert_thread_to_fiber();
+            enable_signal_stack();
             worker_function(fs); // todo(markusl): handle return error code
-            ConvertFiberToThread();
+            disable_signal_stack();
+            convert_fiber_to_thread();
         });
     }
 
     // Wait for worker threads to exit
     for (int i = 0; i < fs.no_of_worker_threads; ++i)
     {
-        fs.worker_threads[i].join();
+        fs.workers[i].thread.join();
     }
-    SwitchToFiber(fs.main_fiber);
+    switch_to_fiber(fs.main_fiber);
 }
 
 } // namespace
 
 int tfb_init_ext(TfbContext** fiber_system, int max_threads)
 {
-    TfbContext* fs = new TfbContext();
-    l_my_fiber_system = fs;
-    if (fiber_system != nullptr)
-        *fiber_system = fs;
+    TfbInitDeclaration init_declaration = {};
+    init_declaration.max_threads = max_threads;
+    return tfb_init_decl_ext(fiber_system, &init_declaration);
+}
 
-    // Init pools etc.
-    fs->job_queue.init(TFB_JOB_QUEUE_SIZE);
-    fs->fiber_pool.init(TFB_FIBER_POOL_SIZE);
+int tfb_init_decl_ext(TfbContext** fiber_system, const TfbInitDeclaration* init_declaration)
+{
+    TfbInitDeclaration decl = {};
+    if (init_declaration != nullptr)
+        decl = *init_declaration;
 
-    // -1 since main thread counts
-    fs->no_of_worker_threads = std::thread::hardware_concurrency();
-    fs->no_of_worker_threads = std::min(fs->no_of_worker_threads, TFB_MAX_NUMBER_OF_THREADS);
+    if (decl.max_threads < 0 || decl.min_active_workers < 0)
+        return -1;
+    if (decl.max_fibers <= 0)
+        decl.max_fibers = TFB_MAX_NUMBER_OF_FIBERS;
+    if (decl.fiber_grow_chunk <= 0)
+        decl.fiber_grow_chunk = TFB_FIBER_GROW_CHUNK;
+    if (decl.max_idle_fibers <= 0)
+        decl.max_idle_fibers = TFB_MAX_IDLE_FIBERS;
+    if (decl.resident_idle_fibers == 0)
+        decl.resident_idle_fibers = TFB_RESIDENT_IDLE_FIBERS;
+    if (decl.park_idle_ms <= 0)
+        decl.park_idle_ms = TFB_PARK_IDLE_MS;
+    decl.idle_spin_count = decl.idle_spin_count == 0 ? TFB_IDLE_SPIN_COUNT : std::max(decl.idle_spin_count, 0);
+    decl.idle_yield_count = decl.idle_yield_count == 0 ? TFB_IDLE_YIELD_COUNT : std::max(decl.idle_yield_count, 0);
+    decl.prewarm_fibers = std::min(decl.prewarm_fibers, decl.max_fibers);
+    for (int i = 0; i < TFB_NUMBER_OF_STACK_CLASSES; ++i)
+    {
+        if (decl.stack_sizes[i] == 0)
+            decl.stack_sizes[i] = TFB_DEFAULT_STACK_SIZES[i];
+        decl.stack_sizes[i] = (decl.stack_sizes[i] + TFB_STACK_GRANULARITY - 1) & ~(TFB_STACK_GRANULARITY - 1);
+    }
 
-    if (max_threads != TFB_ALL_CORES)
-        fs->no_of_worker_threads = std::min(fs->no_of_worker_threads, max_threads);
+    // Pinned workers, the number of CPUs bounds the number of workers. Unpinned workers all share one node,
+    // they do not need the topology and init skips reading it.
+    std::vector<utils::TinyCpu> cpus;
+    if (decl.worker_affinity != TFB_AFFINITY_NONE)
+        cpus = utils::tiny_topology_cpus();
+    std::vector<int> worker_cpus;
+    if (decl.worker_affinity == TFB_AFFINITY_PHYSICAL_CORES)
+    {
+        worker_cpus = utils::tiny_topology_physical_cores(cpus);
+    }
+    else if (decl.worker_affinity == TFB_AFFINITY_CPU_LIST)
+    {
+        if (decl.cpu_list == nullptr || decl.cpu_list_size <= 0)
+            return -1;
 
-    void** allocated_fibers = nullptr;
-    if (fs->fiber_pool.allocate(TFB_NUMBER_OF_FIBERS, &allocated_fibers) != TinyRingBufferStatus::SUCCESS)
+        for (int i = 0; i < decl.cpu_list_size; ++i)
+        {
+            const int cpu = decl.cpu_list[i];
+            if (std::none_of(cpus.begin(), cpus.end(), [cpu](const utils::TinyCpu& allowed) { return allowed.cpu == cpu; }))
+                return -1;
+            worker_cpus.push_back(cpu);
+        }
+    }
+    else if (decl.worker_affinity != TFB_AFFINITY_NONE)
+    {
         return -1;
+    }
+
+    int no_of_workers = std::max(1, (int)std::thread::hardware_concurrency());
+    if (!worker_cpus.empty())
+        no_of_workers = (int)worker_cpus.size();
+    if (decl.max_threads != TFB_ALL_CORES)
+        no_of_workers = std::min(no_of_workers, decl.max_threads);
+
+    if (decl.min_active_workers > no_of_workers)
+        return -1;
+
+    install_stack_overflow_handler();
 
-    for (int i = 0; i < TFB_NUMBER_OF_FIBERS; ++i)
+    // Nothing is published and no thread runs until the end, failures just delete the context
+    std::unique_ptr<TfbContext, void (*)(TfbContext*)> fs(new TfbContext(), delete_context);
+    fs->config = decl;
+
+    // Init pools etc.
+    if (fs->high_priority_queue.init(fs->high_priority_queue.buffer_size_for(TFB_PRIORITY_QUEUE_SIZE)) != TinyRingBufferStatus::SUCCESS ||
+        fs->low_priority_queue.init(fs->low_priority_queue.buffer_size_for(TFB_PRIORITY_QUEUE_SIZE)) != TinyRingBufferStatus::SUCCESS)
+        return -1;
+    for (auto& pool : fs->fiber_pools)
+    {
+        if (pool.init(pool.buffer_size_for(std::max(decl.max_idle_fibers, decl.prewarm_fibers) + decl.fiber_grow_chunk)) !=
+            TinyRingBufferStatus::SUCCESS)
+            return -1;
+    }
+
+    create_workers(*fs, no_of_workers);
+    fs->active_workers = no_of_workers;
+    fs->target_workers = no_of_workers;
+
+    // Busy waiting takes the only CPU from the submitter, elsewhere a few spinners are enough
+    const int hardware_threads = (int)std::thread::hardware_concurrency();
+    if (hardware_threads < 2)
+    {
+        fs->config.idle_spin_count = 0;
+        fs->config.idle_yield_count = 0;
+    }
+    fs->max_spinning_workers = std::max(1, std::min(no_of_workers, hardware_threads) / 2);
+    fs->config.min_active_workers = std::max(1, std::min(decl.min_active_workers, no_of_workers));
+    for (int i = 0; i < fs->no_of_worker_threads; ++i)
+    {
+        if (fs->workers[i].job_deque.init(TFB_WORKER_DEQUE_SIZE) != TinyDequeStatus::SUCCESS)
+            return -1;
+        fs->workers[i].random_state = 2463534242u + (uint32_t)i * 7919u;
+        fs->workers[i].cpu = worker_cpus.empty() ? -1 : worker_cpus[i % worker_cpus.size()];
+    }
+
+    // Group the workers by the NUMA node of their CPU
+    std::vector<int> os_nodes;
+    for (int i = 0; i < fs->no_of_worker_threads; ++i)
+    {
+        const int cpu = fs->workers[i].cpu;
+        auto pinned_to = std::find_if(cpus.begin(), cpus.end(), [cpu](const utils::TinyCpu& c) { return c.cpu == cpu; });
+        const int os_node = pinned_to == cpus.end() ? 0 : pinned_to->node;
+        auto known = std::find(os_nodes.begin(), os_nodes.end(), os_node);
+        fs->workers[i].node = (int)(known - os_nodes.begin());
+        if (known == os_nodes.end())
+            os_nodes.push_back(os_node);
+    }
+
+    fs->no_of_nodes = (int)os_nodes.size();
+    fs->nodes.reset(new TfbNode[fs->no_of_nodes]);
+    for (int i = 0; i < fs->no_of_nodes; ++i)
+    {
+        if (fs->nodes[i].job_queue.init(TFB_JOB_QUEUE_SIZE) != TinyRingBufferStatus::SUCCESS)
+            return -1;
+        fs->nodes[i].os_node = os_nodes[i];
+    }
+    for (int i = 0; i < fs->no_of_worker_threads; ++i)
+    {
+        fs->nodes[fs->workers[i].node].no_of_workers++;
+        fs->nodes[fs->workers[i].node].active_workers++;
+    }
+    for (const utils::TinyCpu& cpu : cpus)
     {
-        void* fiber = CreateFiber(TFB_DEFAULT_STACKSIZE, fiber_main_loop, fs);
+        auto known = std::find(os_nodes.begin(), os_nodes.end(), cpu.node);
+        if (known == os_nodes.end())
+            continue;
+        if (cpu.cpu >= (int)fs->node_of_cpu.size())
+            fs->node_of_cpu.resize(cpu.cpu + 1, 0);
+        fs->node_of_cpu[cpu.cpu] = (int)(known - os_nodes.begin());
+    }
+
+    // More fibers are created on demand by acquire_fiber()
+    for (int i = 0; i < decl.prewarm_fibers; ++i)
+    {
+        TfbFiber* fiber = create_fiber(decl.stack_sizes[TFB_STACK_DEFAULT], fiber_main_loop, fs.get(), decl.track_stack_usage != 0);
         if (fiber == nullptr)
+            return -1;
+        fiber->stack_class = TFB_STACK_DEFAULT;
+        fs->no_of_fibers++;
+        if (fs->fiber_pools[TFB_STACK_DEFAULT].enqueue(fiber) != TinyRingBufferStatus::SUCCESS)
         {
-            // DWORD err = GetLastError();
-            // todo(markusl): free
+            delete_fiber(fiber);
             return -1;
         }
-        allocated_fibers[i] = fiber;
     }
 
+    fs->init_fibers_fiber = create_fiber(TFB_DEFAULT_STACKSIZE, start_workers, fs.get());
+    if (fs->init_fibers_fiber == nullptr)
+        return -1;
+
+    thread_state().fiber_system = fs.get();
+    if (fiber_system != nullptr)
+        *fiber_system = fs.get();
+
     // Switch away from main thread and start worker system
-    fs->main_fiber = ConvertThreadToFiber(nullptr);
-    fs->init_fibers_fiber = CreateFiber(TFB_DEFAULT_STACKSIZE, start_workers, fs);
-    SwitchToFiber(fs->init_fibers_fiber); // Lose main fiber from main thread
+    fs->main_fiber = convert_thread_to_fiber();
+    switch_to_fiber(fs.release()->init_fibers_fiber); // Lose main fiber from main thread
     // Worker thread will execute from here now
     return 0;
 }
@@ -256,7 +1547,7 @@ int tfb_init_ext(TfbContext** fiber_system, int max_threads)
 // Must be called from main fiber (eg, from no job)
 int tfb_free_ext(TfbContext** fiber_system)
 {
-    TfbContext* fs = l_my_fiber_system;
+    TfbContext* fs = my_fiber_system();
 
     if (fs == nullptr)
         return -1;
@@ -265,27 +1556,21 @@ int tfb_free_ext(TfbContext** fiber_system)
         return -1;
 
     {
-        std::lock_guard<std::mutex> lk(fs->pending_jobs_mx);
+        std::lock_guard<std::mutex> lk(fs->no_job_mx);
         fs->should_exit = true;
     }
 
     fs->no_job_cv.notify_all();
+    fs->park_cv.notify_all();
 
-    SwitchToFiber(fs->l_worker_fiber);
+    switch_to_fiber(thread_state().worker_fiber);
 
-    ConvertFiberToThread();
-
-    // Delete fibers
-    DeleteFiber(fs->init_fibers_fiber);
-    void** deallocate_fibers = fs->fiber_pool.data();
-    for (int i = 0; i < TFB_NUMBER_OF_FIBERS; ++i)
-        DeleteFiber(deallocate_fibers[i]);
-    fs->fiber_pool.free();
-    fs->job_queue.free();
+    // Back at the thread that called tfb_init
+    convert_fiber_to_thread();
 
-    delete fs;
+    delete_context(fs);
 
-    l_my_fiber_system = nullptr;
+    thread_state().fiber_system = nullptr;
     if (fiber_system != nullptr)
         *fiber_system = nullptr;
 
@@ -300,20 +1585,23 @@ int tfb_add_jobdecl_ext(TfbContext* fiber_system, TfbJobDeclaration* job)
     if (job->func == nullptr)
         return 0;
 
-    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? l_my_fiber_system : fiber_system);
+    if (!valid_job(*job))
+        return -1;
+
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
 
     if (job->wait_handle != nullptr)
-        reinterpret_cast<std::atomic_int64_t&>(job->wait_handle->_counter)++;
-
-    TinyRingBufferStatus sts = fs.job_queue.enqueue(*job);
-    if (sts != TinyRingBufferStatus::SUCCESS)
-        return -1;
+        wait_handle_counter(job->wait_handle)++;
 
+    if (!push_job(fs, *job))
     {
-        std::lock_guard<std::mutex> lk(fs.pending_jobs_mx);
-        ++fs.no_of_pending_jobs;
+        if (job->wait_handle != nullptr)
+            wait_handle_counter(job->wait_handle)--;
+        return -1;
     }
-    fs.no_job_cv.notify_one();
+
+    ++fs.no_of_pending_jobs;
+    wake_workers(fs, 1);
 
     return 0;
 }
@@ -321,54 +1609,156 @@ int tfb_add_jobdecl_ext(TfbContext* fiber_system, TfbJobDeclaration* job)
 // Must have the same WaitHandler*
 int tfb_add_jobdecls_ext(TfbContext* fiber_system, TfbJobDeclaration jobs[], int64_t elements)
 {
-    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? l_my_fiber_system : fiber_system);
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+
+    for (int64_t i = 0; i < elements; ++i)
+    {
+        if (!valid_job(jobs[i]))
+            return -1;
+    }
 
     if (jobs[0].wait_handle != nullptr)
-        reinterpret_cast<std::atomic_int64_t&>(jobs[0].wait_handle->_counter) += elements;
+        wait_handle_counter(jobs[0].wait_handle) += elements;
 
-    if (fs.job_queue.enqueue(jobs, elements) != TinyRingBufferStatus::SUCCESS)
-        return -1;
+    int64_t pushed = 0;
+    while (pushed < elements && push_job(fs, jobs[pushed]))
+        ++pushed;
 
+    fs.no_of_pending_jobs += pushed;
+    wake_workers(fs, pushed);
+
+    if (pushed != elements)
     {
-        std::lock_guard<std::mutex> lk(fs.pending_jobs_mx);
-        fs.no_of_pending_jobs += elements;
+        if (jobs[0].wait_handle != nullptr)
+            wait_handle_counter(jobs[0].wait_handle) -= elements - pushed;
+        return -1;
     }
-    fs.no_job_cv.notify_all();
 
     return 0;
 }
 
+int tfb_add_and_run_ext(TfbContext* fiber_system, TfbJobDeclaration jobs[], int64_t elements)
+{
+    if (elements <= 0)
+        return 0;
+
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+    TfbJobDeclaration& last = jobs[elements - 1];
+    if (!valid_job(last))
+        return -1;
+
+    if (elements > 1 && tfb_add_jobdecls_ext(&fs, jobs, elements - 1) != 0)
+        return -1;
+
+    // Not enough stack left here, or not on a fiber of fs
+    TfbThreadState& ts = thread_state();
+    if (ts.fiber_system != &fs || ts.current_fiber == nullptr || remaining_stack() < fs.config.stack_sizes[last.stack_class] / 2)
+        return tfb_add_jobdecl_ext(&fs, &last);
+
+    if (last.func == nullptr)
+        return 0;
+
+    if (last.wait_handle != nullptr)
+        wait_handle_counter(last.wait_handle)++;
+
+    run_job_inline(fs, last.func, last.user_data);
+
+    // The caller is the only awaiter and has not awaited yet, no one to resume
+    complete_job(last.wait_handle);
+    return 0;
+}
+
 int tfb_await_ext(TfbContext* fiber_system, TfbWaitHandle* wait_handle)
 {
     if (wait_handle == nullptr)
         return -1;
 
-    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? l_my_fiber_system : fiber_system);
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+
+    run_inline(fs, wait_handle);
 
-    AcquireSRWLockExclusive((PSRWLOCK)&wait_handle->_lock);
+    wait_handle_lock(wait_handle).lock();
 
     // Put this to fiber queue
-    if (reinterpret_cast<std::atomic_int64_t&>(wait_handle->_counter).load() == 0)
+    if (wait_handle_counter(wait_handle).load() == 0)
     {
-        ReleaseSRWLockExclusive((PSRWLOCK)&wait_handle->_lock);
+        wait_handle_lock(wait_handle).unlock();
         return 0;
     }
 
-    wait_handle->_fiber = GetCurrentFiber();
-    fs.l_wait_handle_lock = (PSRWLOCK)&wait_handle->_lock;
-
-    void* new_fiber;
-    if (fs.fiber_pool.dequeue(&new_fiber) == TinyRingBufferStatus::SUCCESS)
+    TfbFiber* new_fiber = acquire_fiber(fs, thread_state().stack_class_hint);
+    if (new_fiber == nullptr)
     {
-        SwitchToFiber(new_fiber);
-        // put back fiber we yield from to pool
-        fs.fiber_pool.enqueue(fs.l_finished_fiber);
-        fs.l_finished_fiber = nullptr;
+        wait_handle_lock(wait_handle).unlock();
+        return -1;
     }
-    else
+
+    wait_handle->_fiber = get_current_fiber();
+    thread_state().wait_handle_lock = &wait_handle_lock(wait_handle);
+
+    switch_to_fiber(new_fiber);
+    // put back fiber we yield from to pool, we may be at another thread now
+    TfbThreadState& ts = thread_state();
+    release_fiber(fs, ts.finished_fiber);
+    ts.finished_fiber = nullptr;
+
+    return 0;
+}
+
+int64_t tfb_stack_usage_ext(TfbContext* fiber_system, TfbStackUsage usage[], int64_t max_elements)
+{
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+
+    std::lock_guard<std::mutex> lk(fs.stack_usage_mx);
+    int64_t i = 0;
+    for (const auto& entry : fs.stack_usage)
     {
+        if (i < max_elements)
+        {
+            const TfbStackUsageRecord& record = entry.second;
+            usage[i].func = entry.first;
+            usage[i].calls = record.calls;
+            usage[i].max_stack_usage = record.max_stack_usage;
+            usage[i].p50_stack_usage = stack_usage_percentile(record, 50);
+            usage[i].p99_stack_usage = stack_usage_percentile(record, 99);
+        }
+        ++i;
+    }
+    return i;
+}
+
+int tfb_set_active_workers_ext(TfbContext* fiber_system, int active_workers)
+{
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+    if (active_workers < 1 || active_workers > fs.no_of_worker_threads)
         return -1;
+
+    {
+        std::lock_guard<std::mutex> lk(fs.no_job_mx);
+        fs.target_workers = active_workers;
     }
 
+    // Parked workers wake up to run, surplus sleepers to park
+    fs.park_cv.notify_all();
+    fs.no_job_cv.notify_all();
     return 0;
 }
+
+int tfb_active_workers_ext(TfbContext* fiber_system)
+{
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+    return fs.active_workers;
+}
+
+int tfb_worker_stats_ext(TfbContext* fiber_system, TfbWorkerStats stats[], int max_elements)
+{
+    TfbContext& fs = *(fiber_system == TFB_MY_CONTEXT ? my_fiber_system() : fiber_system);
+    for (int i = 0; i < std::min(max_elements, fs.no_of_worker_threads); ++i)
+    {
+        const TfbWorker& worker = fs.workers[i];
+        stats[i].spin_wakeups = worker.spin_wakeups.load(std::memory_order_relaxed);
+        stats[i].yield_wakeups = worker.yield_wakeups.load(std::memory_order_relaxed);
+        stats[i].sleeps = worker.sleeps.load(std::memory_order_relaxed);
+    }
+    return fs.no_of_worker_threads;
+}
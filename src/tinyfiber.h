@@ -42,13 +42,84 @@ extern "C"
         void* _lock;
     } TfbWaitHandle;
 
+    // Stack size classes, a job runs on a fiber with at least the stack of its class. An enum since array
+    // sizes must be constant expressions in C.
+    enum
+    {
+        TFB_STACK_DEFAULT = 0, // 1 MiB by default
+        TFB_STACK_SMALL = 1,   // 16 KiB by default
+        TFB_STACK_MEDIUM = 2,  // 64 KiB by default
+        TFB_NUMBER_OF_STACK_CLASSES = 3
+    };
+
+    // Job priorities, workers take high priority jobs before any other and low priority jobs when there is
+    // nothing else to do, or every 32nd job so they are not starved
+    enum
+    {
+        TFB_PRIORITY_NORMAL = 0,
+        TFB_PRIORITY_HIGH = 1,
+        TFB_PRIORITY_LOW = 2,
+        TFB_NUMBER_OF_PRIORITIES = 3
+    };
+
     typedef struct
     {
         void (*func)(void*);
         void* user_data;
         TfbWaitHandle* wait_handle;
+        int stack_class; // one of TFB_STACK_*, zero gives TFB_STACK_DEFAULT
+        int priority;    // one of TFB_PRIORITY_*, zero gives TFB_PRIORITY_NORMAL
+        int node;        // 1 + the NUMA node that should run the job, zero gives the node of the submitter
     } TfbJobDeclaration;
 
+    // Worker placement, see TfbInitDeclaration::worker_affinity. Pinned workers are grouped by NUMA node, each
+    // node has its own queue and idle workers steal from their own node first. Node hints of jobs only have an
+    // effect on nodes with pinned workers, high and low priority jobs ignore them.
+    const int TFB_AFFINITY_NONE = 0;           // the OS schedules the workers
+    const int TFB_AFFINITY_PHYSICAL_CORES = 1; // one worker per physical core, pinned to it
+    const int TFB_AFFINITY_CPU_LIST = 2;       // worker i is pinned to cpu_list[i % cpu_list_size]
+
+    // Optional settings for tfb_init_decl_ext(), init to zero to get the defaults
+    typedef struct
+    {
+        int max_threads;                                 // see tfb_init_ext(), TFB_ALL_CORES by default, negative fails
+        int prewarm_fibers;                              // default stack class fibers created up front, the rest are created on demand, 0 by default
+        int max_fibers;                                  // ceiling of all stack classes together, await fails beyond it, 16384 by default
+        int fiber_grow_chunk;                            // fibers created at once when the pool runs dry, 16 by default
+        int max_idle_fibers;                             // idle fibers kept per stack class, surplus is deleted when returned, 1024 by default
+        size_t stack_sizes[TFB_NUMBER_OF_STACK_CLASSES]; // bytes per stack class, zero gives the default of the class
+        int resident_idle_fibers;                        // idle fibers per stack class that keep their stack memory, 64 by default, -1 never trims
+        int track_stack_usage;                           // non-zero paints fiber stacks and measures each job, see tfb_stack_usage_ext(). Slow.
+        int worker_affinity;                             // one of TFB_AFFINITY_*, TFB_AFFINITY_NONE by default
+        const int* cpu_list;                             // logical CPUs for TFB_AFFINITY_CPU_LIST, also bounds the number of workers
+        int cpu_list_size;
+        int auto_scale_workers;                          // non-zero parks workers that idle for park_idle_ms, they come back when jobs queue up
+        int min_active_workers;                          // auto scaling keeps this many workers active, 1 by default, more than the workers fails
+        int park_idle_ms;                                // 100 by default
+        int idle_spin_count;                             // spin waits of an idle worker before it yields, 1024 by default, -1 never spins.
+                                                         // Half of the workers spin at most.
+        int idle_yield_count;                            // yields of an idle worker before it sleeps, 16 by default, -1 never yields.
+                                                         // On a single CPU idle workers sleep right away.
+    } TfbInitDeclaration;
+
+    // Stack usage of one job function, in bytes from the top of the fiber stack
+    typedef struct
+    {
+        void (*func)(void*);
+        int64_t calls;
+        size_t max_stack_usage;
+        size_t p50_stack_usage; // percentiles are rounded up to 256 bytes
+        size_t p99_stack_usage;
+    } TfbStackUsage;
+
+    // How the idle moments of one worker ended, see tfb_worker_stats_ext()
+    typedef struct
+    {
+        int64_t spin_wakeups;  // work showed up while spinning
+        int64_t yield_wakeups; // work showed up while yielding to other threads
+        int64_t sleeps;        // went to sleep in the OS, a submitter had to wake it
+    } TfbWorkerStats;
+
     const int TFB_ALL_CORES = 0;
     TfbContext* const TFB_MY_CONTEXT = NULL;
 
@@ -62,13 +133,33 @@ extern "C"
      * @endcode
      *
      * @param fiber_system is your in-out pointer to a TfbContext pointer. Initialize to NULL before use.
-     * @param max_threads descibes how many working threads your fiber system should have.
+     * @param max_threads descibes how many working threads your fiber system should have. There is one per
+     *        hardware thread at most, TFB_ALL_CORES gives exactly that.
      * @return 0 if successful, otherwise the error code.
      * @see tfb_init()
      * @see rfb_free_ext()
      */
     int tfb_init_ext(TfbContext** fiber_system, int max_threads);
 
+    /**
+     * @brief Creates a new fiber system context with the given settings.
+     *
+     * @code
+     * TfbContext* fiber_system = NULL;
+     * TfbInitDeclaration init_declaration = {0};
+     * init_declaration.prewarm_fibers = 64;
+     * init_declaration.stack_sizes[TFB_STACK_SMALL] = 32 * 1024;
+     * tfb_init_decl_ext(&fiber_system, &init_declaration);
+     * tfb_free_ext(&fiber_system);
+     * @endcode
+     *
+     * @param fiber_system is your in-out pointer to a TfbContext pointer. Initialize to NULL before use.
+     * @param init_declaration settings, NULL gives the defaults.
+     * @return 0 if successful, otherwise the error code.
+     * @see tfb_init_ext()
+     */
+    int tfb_init_decl_ext(TfbContext** fiber_system, const TfbInitDeclaration* init_declaration);
+
     inline int tfb_init()
     {
         return tfb_init_ext(NULL, TFB_ALL_CORES);
@@ -95,15 +186,41 @@ extern "C"
         return tfb_add_jobdecls_ext(TFB_MY_CONTEXT, jobs, elements);
     }
 
+    /**
+     * @brief Adds all but the last job and runs the last one right away on the calling fiber.
+     *
+     * @code
+     * TfbWaitHandle wh = {0};
+     * TfbJobDeclaration halves[2] = {{split, &left, &wh}, {split, &right, &wh}};
+     * tfb_add_and_run(halves, 2);
+     * tfb_await(&wh);
+     * @endcode
+     *
+     * The caller must be the only one to await the wait handle of the jobs, and must do it after this returns.
+     * The last job is added as usual instead if the calling fiber has less than half of its stack class left,
+     * or if it is not a fiber of the fiber system.
+     *
+     * @param fiber_system context, or TFB_MY_CONTEXT.
+     * @param jobs with the same wait handle.
+     * @param elements number of jobs.
+     * @return 0 if successful, otherwise the error code.
+     */
+    int tfb_add_and_run_ext(TfbContext* fiber_system, TfbJobDeclaration jobs[], int64_t elements);
+
+    inline int tfb_add_and_run(TfbJobDeclaration jobs[], int64_t elements)
+    {
+        return tfb_add_and_run_ext(TFB_MY_CONTEXT, jobs, elements);
+    }
+
     inline int tfb_add_job_ext(TfbContext* fiber_system, void (*func)(void*), void* user_data, TfbWaitHandle* wh)
     {
-        TfbJobDeclaration job = {func, user_data, wh};
+        TfbJobDeclaration job = {func, user_data, wh, TFB_STACK_DEFAULT, TFB_PRIORITY_NORMAL, 0};
         return tfb_add_jobdecl_ext(fiber_system, &job);
     }
 
     inline int tfb_add_job(void (*func)(void*), void* user_data, TfbWaitHandle* wh)
     {
-        TfbJobDeclaration job = {func, user_data, wh};
+        TfbJobDeclaration job = {func, user_data, wh, TFB_STACK_DEFAULT, TFB_PRIORITY_NORMAL, 0};
         return tfb_add_jobdecl(&job);
     }
 
@@ -114,6 +231,61 @@ extern "C"
         return tfb_await_ext(TFB_MY_CONTEXT, wait_handle);
     }
 
+    /**
+     * @brief Reports the stack usage per job function, requires TfbInitDeclaration::track_stack_usage.
+     *
+     * @code
+     * TfbStackUsage usage[64];
+     * int64_t functions = tfb_stack_usage_ext(TFB_MY_CONTEXT, usage, 64);
+     * @endcode
+     *
+     * Stacks are painted when the fiber is created and scanned after each job, only jobs that ran to the end
+     * are counted. Jobs run inline by tfb_await_ext() or tfb_add_and_run_ext() count from the frame that ran
+     * them, and also count for the job below them. Jobs run inline on a thread's own stack are not counted.
+     * Not supported on Windows, it reports no functions.
+     *
+     * @param fiber_system context, or TFB_MY_CONTEXT.
+     * @param usage array that gets the first max_elements functions, in no particular order.
+     * @param max_elements size of usage.
+     * @return number of job functions recorded, may be more than max_elements.
+     */
+    int64_t tfb_stack_usage_ext(TfbContext* fiber_system, TfbStackUsage usage[], int64_t max_elements);
+
+    /**
+     * @brief Changes how many of the workers run jobs, the others are parked and use no CPU.
+     *
+     * @code
+     * tfb_set_active_workers_ext(TFB_MY_CONTEXT, 2); // quiet hours
+     * @endcode
+     *
+     * Workers park when they are idle or done with their current job, any of them may be the one to park. Jobs
+     * already in the queues of a parked worker are stolen by the active ones. With TfbInitDeclaration::auto_scale_workers the count keeps changing
+     * with the load afterwards.
+     *
+     * @param fiber_system context, or TFB_MY_CONTEXT.
+     * @param active_workers from 1 up to the number of workers created by init.
+     * @return 0 if successful, otherwise the error code.
+     */
+    int tfb_set_active_workers_ext(TfbContext* fiber_system, int active_workers);
+
+    /**
+     * @brief Reports how idle workers waited for work, to tune TfbInitDeclaration::idle_spin_count and idle_yield_count.
+     *
+     * @code
+     * TfbWorkerStats stats[64];
+     * int workers = tfb_worker_stats_ext(TFB_MY_CONTEXT, stats, 64);
+     * @endcode
+     *
+     * @param fiber_system context, or TFB_MY_CONTEXT.
+     * @param stats array that gets the first max_elements workers.
+     * @param max_elements size of stats.
+     * @return number of workers, may be more than max_elements.
+     */
+    int tfb_worker_stats_ext(TfbContext* fiber_system, TfbWorkerStats stats[], int max_elements);
+
+    // Number of workers that are not parked, see tfb_set_active_workers_ext(). Lags behind it until busy workers are idle.
+    int tfb_active_workers_ext(TfbContext* fiber_system);
+
 #ifdef __cplusplus
 }
 #endif
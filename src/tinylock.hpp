@@ -0,0 +1,124 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#include <Windows.h>
+#include <synchapi.h>
+#else
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace utils
+{
+// Pointer sized exclusive lock, zero initialized memory is an unlocked lock.
+// It has no owner, it may be released by another thread or fiber than the one that acquired it.
+class TinyLock
+{
+public:
+    TinyLock()
+#ifdef _WIN32
+        : m_lock(SRWLOCK_INIT)
+#else
+        : m_state(0)
+#endif
+    {
+    }
+
+    TinyLock(const TinyLock&) = delete;
+    TinyLock& operator=(const TinyLock&) = delete;
+
+#ifdef _WIN32
+    void lock()
+    {
+        AcquireSRWLockExclusive(&m_lock);
+    }
+
+    bool try_lock()
+    {
+        return TryAcquireSRWLockExclusive(&m_lock) != 0;
+    }
+
+    void unlock()
+    {
+        ReleaseSRWLockExclusive(&m_lock);
+    }
+#else
+    // m_state: 0 unlocked, 1 locked, 2 locked with possible sleepers
+    void lock()
+    {
+        uint32_t c = 0;
+        if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire))
+            return;
+
+        for (int spin = 0; spin < SPIN_COUNT && c != 2; ++spin)
+        {
+            c = 0;
+            if (m_state.compare_exchange_weak(c, 1, std::memory_order_acquire))
+                return;
+        }
+
+        if (c != 2)
+            c = m_state.exchange(2, std::memory_order_acquire);
+
+        while (c != 0)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state), FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+            c = m_state.exchange(2, std::memory_order_acquire);
+        }
+    }
+
+    bool try_lock()
+    {
+        uint32_t c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+
+    void unlock()
+    {
+        if (m_state.exchange(0, std::memory_order_release) == 2)
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#endif
+
+private:
+#ifdef _WIN32
+    SRWLOCK m_lock;
+#else
+    static const int SPIN_COUNT = 100;
+    std::atomic<uint32_t> m_state;
+#endif
+};
+
+static_assert(sizeof(TinyLock) <= sizeof(void*), "TinyLock must fit in TfbWaitHandle::_lock");
+} // namespace utils
@@ -23,14 +23,41 @@ SOFTWARE.
 */
 
 #pragma once
+
+#include "tinylock.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#ifdef _WIN32
 #define NOMINMAX
 #define WIN32_LEAN_AND_MEAN
 #define VC_EXTRALEAN
-
-#include <stdint.h>
 #include <Windows.h>
-#include <synchapi.h>
-#include <atomic>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Consumed elements are overwritten with 0xAB to catch use of dequeued data. It writes every element
+// a second time on the consumer side, so by default it is only on in debug and sanitizer builds. Define
+// TINYRINGBUFFER_POISON to 0 or 1 to override, CMake does with TINYFIBER_POISON_RING_BUFFERS.
+#ifndef TINYRINGBUFFER_POISON
+#if !defined(NDEBUG) || defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define TINYRINGBUFFER_POISON 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define TINYRINGBUFFER_POISON 1
+#endif
+#endif
+#endif
+
+#ifndef TINYRINGBUFFER_POISON
+#define TINYRINGBUFFER_POISON 0
+#endif
 
 namespace utils
 {
@@ -43,33 +70,61 @@ enum class TinyRingBufferStatus
     INVALID_ARGUMENT = 4
 };
 
-template <typename T>
-class TinyRingBuffer
+// Memory mapped twice after each other in virtual memory, so that an element or a batch of elements
+// that wraps around the end of the buffer is still contiguous.
+class TinyMirroredBuffer
 {
 public:
-    TinyRingBuffer()
-        : m_head(0)
-        , m_tail(0)
-        , m_used_bytes(0)
-        , m_buffer_size(0) // Make it a multiple of a page size, 64K
-        , m_lock(SRWLOCK_INIT)
+    int64_t buffer_size() const
+    {
+        return m_buffer_size;
+    }
+
+    static bool is_poisoning()
+    {
+        return TINYRINGBUFFER_POISON != 0;
+    }
+
+    bool is_inited() const
+    {
+        return m_buffer != nullptr;
+    }
+
+protected:
+    TinyMirroredBuffer()
+        : m_buffer_size(0) // Make it a multiple of a page size, 64K
         , m_buffer(nullptr)
-        , m_handle()
+#ifdef _WIN32
         , m_map()
+        , m_handle()
+#endif
     {
     }
 
-    ~TinyRingBuffer()
+    ~TinyMirroredBuffer()
     {
-        free();
+        unmap_buffer();
     }
 
-    // To make it easier to use BSS
-    TinyRingBufferStatus init(int64_t buffer_size)
+    TinyMirroredBuffer(const TinyMirroredBuffer&) = delete;
+    TinyMirroredBuffer& operator=(const TinyMirroredBuffer&) = delete;
+
+    static void poison(void* consumed, int64_t byte_size)
+    {
+#if TINYRINGBUFFER_POISON
+        memset(consumed, 0xAB, (size_t)byte_size);
+#else
+        (void)consumed;
+        (void)byte_size;
+#endif
+    }
+
+    TinyRingBufferStatus map_buffer(int64_t buffer_size)
     {
         if (buffer_size & 0xffff)
             return TinyRingBufferStatus::INVALID_ARGUMENT;
 
+#ifdef _WIN32
         int tries = 0;
         while (tries < 5 && m_buffer == nullptr)
         {
@@ -84,7 +139,7 @@ public:
                     INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(virtual_size >> 32), (DWORD)(virtual_size & 0xffffffffu), nullptr);
                 if (m_handle == nullptr)
                 {
-                    free();
+                    unmap_buffer();
                 }
                 else
                 {
@@ -92,20 +147,56 @@ public:
                     void* map2 = MapViewOfFileEx(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)m_buffer_size, m_buffer + m_buffer_size);
 
                     if (m_map == nullptr || map2 == nullptr)
-                        free();
+                        unmap_buffer();
                 }
 
                 tries++;
             }
         }
+#else
+        // Anonymous memory object, there is no name that can collide or leak
+        int fd = memfd_create("tinyringbuffer", MFD_CLOEXEC);
+        if (fd < 0)
+            return TinyRingBufferStatus::MEMORY_ERROR;
+
+        if (ftruncate(fd, (off_t)buffer_size) != 0)
+        {
+            close(fd);
+            return TinyRingBufferStatus::MEMORY_ERROR;
+        }
+
+        // Reserve both halves at once, then map the object twice on top of the reservation.
+        // MAP_FIXED replaces our own reservation, nothing else can be mapped in between.
+        void* reserved = mmap(nullptr, (size_t)buffer_size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED)
+        {
+            close(fd);
+            return TinyRingBufferStatus::MEMORY_ERROR;
+        }
+
+        uint8_t* buffer = (uint8_t*)reserved;
+        void* map1 = mmap(buffer, (size_t)buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        void* map2 = mmap(buffer + buffer_size, (size_t)buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        close(fd);
+
+        if (map1 == MAP_FAILED || map2 == MAP_FAILED)
+        {
+            munmap(reserved, (size_t)buffer_size * 2);
+            return TinyRingBufferStatus::MEMORY_ERROR;
+        }
+
+        m_buffer = buffer;
+        m_buffer_size = buffer_size;
+#endif
 
         if (m_buffer == nullptr)
             return TinyRingBufferStatus::MEMORY_ERROR;
         return TinyRingBufferStatus::SUCCESS;
     }
 
-    TinyRingBufferStatus free()
+    TinyRingBufferStatus unmap_buffer()
     {
+#ifdef _WIN32
         bool a = UnmapViewOfFile(m_map);
         bool b = UnmapViewOfFile((uint8_t*)m_map + m_buffer_size);
         if (a == 0 || b == 0)
@@ -113,18 +204,72 @@ public:
             return TinyRingBufferStatus::MEMORY_ERROR;
         }
         m_map = nullptr;
+#else
+        if (m_buffer == nullptr || munmap(m_buffer, (size_t)m_buffer_size * 2) != 0)
+        {
+            return TinyRingBufferStatus::MEMORY_ERROR;
+        }
+#endif
         m_buffer = 0;
         m_buffer_size = 0;
-        m_head = 0;
-        m_tail = 0;
-        m_used_bytes = 0;
 
+#ifdef _WIN32
         if (m_handle != nullptr)
         {
             CloseHandle(m_handle);
             m_handle = nullptr;
         }
+#endif
+
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    int64_t m_buffer_size;
+    uint8_t* m_buffer;
+
+#ifdef _WIN32
+    void* m_map;
+    HANDLE m_handle;
+#endif
+};
+
+enum class TinyRingBufferMode
+{
+    LOCKED = 0, // Any number of producers and consumers, all operations take an exclusive lock
+    MPMC = 1,   // Any number of producers and consumers, lock-free single element operations
+    SPSC = 2    // One producer thread and one consumer thread, wait-free
+};
+
+template <typename T, TinyRingBufferMode M = TinyRingBufferMode::LOCKED>
+class TinyRingBuffer;
+
+template <typename T>
+class TinyRingBuffer<T, TinyRingBufferMode::LOCKED> : public TinyMirroredBuffer
+{
+public:
+    TinyRingBuffer()
+        : m_head(0)
+        , m_tail(0)
+        , m_used_bytes(0)
+        , m_lock()
+    {
+    }
+
+    // To make it easier to use BSS
+    TinyRingBufferStatus init(int64_t buffer_size)
+    {
+        return map_buffer(buffer_size);
+    }
+
+    TinyRingBufferStatus free()
+    {
+        TinyRingBufferStatus sts = unmap_buffer();
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
 
+        m_head = 0;
+        m_tail = 0;
+        m_used_bytes = 0;
         return TinyRingBufferStatus::SUCCESS;
     }
 
@@ -138,10 +283,10 @@ public:
         }
 
         const int64_t byte_size = (int64_t)sizeof(T) * elements;
-        AcquireSRWLockExclusive(&m_lock);
+        m_lock.lock();
         if (m_used_bytes + byte_size > m_buffer_size)
         {
-            ReleaseSRWLockExclusive(&m_lock);
+            m_lock.unlock();
             if (ptr != nullptr)
                 *ptr = nullptr;
             return TinyRingBufferStatus::BUFFER_FULL;
@@ -150,7 +295,7 @@ public:
         m_head = (m_head + byte_size) % m_buffer_size;
         m_used_bytes += byte_size;
 
-        ReleaseSRWLockExclusive(&m_lock);
+        m_lock.unlock();
         if (ptr != nullptr)
             *ptr = p;
         return TinyRingBufferStatus::SUCCESS;
@@ -159,10 +304,10 @@ public:
     TinyRingBufferStatus enqueue(const T& src)
     {
         const int64_t byte_size = (int64_t)sizeof(T);
-        AcquireSRWLockExclusive(&m_lock);
+        m_lock.lock();
         if (m_used_bytes + byte_size > m_buffer_size)
         {
-            ReleaseSRWLockExclusive(&m_lock);
+            m_lock.unlock();
             return TinyRingBufferStatus::BUFFER_FULL;
         }
 
@@ -170,85 +315,157 @@ public:
         m_head = (m_head + byte_size) % m_buffer_size;
         m_used_bytes += byte_size;
 
-        ReleaseSRWLockExclusive(&m_lock);
+        m_lock.unlock();
         return TinyRingBufferStatus::SUCCESS;
     }
 
     TinyRingBufferStatus enqueue(const T* src, int64_t elements)
     {
         const int64_t byte_size = (int64_t)sizeof(T) * elements;
-        AcquireSRWLockExclusive(&m_lock);
+        m_lock.lock();
         if (m_used_bytes + byte_size > m_buffer_size)
         {
-            ReleaseSRWLockExclusive(&m_lock);
+            m_lock.unlock();
             return TinyRingBufferStatus::BUFFER_FULL;
         }
 
-        for (int n = 0; n < elements; ++n)
-            reinterpret_cast<T*>(m_buffer + m_head)[n] = src[n];
+        std::copy(src, src + elements, reinterpret_cast<T*>(m_buffer + m_head));
 
         m_head = (m_head + byte_size) % m_buffer_size;
         m_used_bytes += byte_size;
 
-        ReleaseSRWLockExclusive(&m_lock);
+        m_lock.unlock();
         return TinyRingBufferStatus::SUCCESS;
     }
 
     TinyRingBufferStatus dequeue(T* dst)
     {
         const int64_t byte_size = (int64_t)sizeof(T);
-        AcquireSRWLockExclusive(&m_lock);
+        m_lock.lock();
 
         if (m_used_bytes - byte_size < 0)
         {
-            ReleaseSRWLockExclusive(&m_lock);
+            m_lock.unlock();
             return TinyRingBufferStatus::BUFFER_EMPTY;
         }
         *dst = *reinterpret_cast<T*>(m_buffer + m_tail);
-        memset(m_buffer + m_tail, 0xAB, sizeof(T));
+        poison(m_buffer + m_tail, byte_size);
 
         m_tail = (m_tail + byte_size) % m_buffer_size;
         m_used_bytes -= byte_size;
 
-        ReleaseSRWLockExclusive(&m_lock);
+        m_lock.unlock();
         return TinyRingBufferStatus::SUCCESS;
     }
 
     TinyRingBufferStatus dequeue(T* dst, int64_t elements)
     {
         const int64_t byte_size = (int64_t)sizeof(T) * elements;
-        AcquireSRWLockExclusive(&m_lock);
+        m_lock.lock();
         if (m_used_bytes - byte_size < 0)
         {
-            ReleaseSRWLockExclusive(&m_lock);
-            return BUFFER_EMPTY;
+            m_lock.unlock();
+            return TinyRingBufferStatus::BUFFER_EMPTY;
         }
 
-        for (int n = 0; n < elements; ++n)
-            dst[n] = reinterpret_cast<T*>(m_buffer + m_head)[n];
+        const T* src = reinterpret_cast<const T*>(m_buffer + m_tail);
+        std::copy(src, src + elements, dst);
 
-        memset(m_buffer + m_tail, 0xAB, sizeof(T) * elements);
+        poison(m_buffer + m_tail, byte_size);
 
         m_tail = (m_tail + byte_size) % m_buffer_size;
         m_used_bytes -= byte_size;
 
-        ReleaseSRWLockExclusive(&m_lock);
-        return SUCCESS;
+        m_lock.unlock();
+        return TinyRingBufferStatus::SUCCESS;
     }
 
-    int64_t buffer_size() const
+    // Dequeues between 1 and max_elements elements in one lock acquisition
+    TinyRingBufferStatus dequeue_up_to(T* dst, int64_t max_elements, int64_t* dequeued)
     {
-        return m_buffer_size;
+        *dequeued = 0;
+        m_lock.lock();
+        const int64_t elements = std::min(max_elements, (int64_t)(m_used_bytes / (int64_t)sizeof(T)));
+        if (elements <= 0)
+        {
+            m_lock.unlock();
+            return TinyRingBufferStatus::BUFFER_EMPTY;
+        }
+
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        const T* src = reinterpret_cast<const T*>(m_buffer + m_tail);
+        std::copy(src, src + elements, dst);
+
+        poison(m_buffer + m_tail, byte_size);
+
+        m_tail = (m_tail + byte_size) % m_buffer_size;
+        m_used_bytes -= byte_size;
+
+        m_lock.unlock();
+        *dequeued = elements;
+        return TinyRingBufferStatus::SUCCESS;
     }
 
-    bool empty() const
+    // Zero-copy enqueue. On success *ptr points to room for elements contiguous T and the lock is
+    // held until commit(), construct the elements in place and keep it short.
+    TinyRingBufferStatus reserve(int64_t elements, T** ptr)
     {
-        return m_used_bytes == 0;
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        m_lock.lock();
+        if (m_used_bytes + byte_size > m_buffer_size)
+        {
+            m_lock.unlock();
+            *ptr = nullptr;
+            return TinyRingBufferStatus::BUFFER_FULL;
+        }
+
+        *ptr = reinterpret_cast<T*>(m_buffer + m_head);
+        return TinyRingBufferStatus::SUCCESS;
     }
 
-    bool is_inited() const
+    // Publishes the first elements of the last reserve(), may be fewer than reserved
+    TinyRingBufferStatus commit(int64_t elements)
     {
-        return m_buffer != nullptr;
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        m_head = (m_head + byte_size) % m_buffer_size;
+        m_used_bytes += byte_size;
+
+        m_lock.unlock();
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Zero-copy dequeue. On success *ptr points to elements contiguous T and the lock is held until release()
+    TinyRingBufferStatus peek(int64_t elements, const T** ptr)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        m_lock.lock();
+        if (m_used_bytes - byte_size < 0)
+        {
+            m_lock.unlock();
+            *ptr = nullptr;
+            return TinyRingBufferStatus::BUFFER_EMPTY;
+        }
+
+        *ptr = reinterpret_cast<const T*>(m_buffer + m_tail);
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Consumes the first elements of the last peek(), may be fewer than peeked
+    TinyRingBufferStatus release(int64_t elements)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        poison(m_buffer + m_tail, byte_size);
+
+        m_tail = (m_tail + byte_size) % m_buffer_size;
+        m_used_bytes -= byte_size;
+
+        m_lock.unlock();
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    bool empty() const
+    {
+        return m_used_bytes == 0;
     }
 
     // non-thread safe access
@@ -266,11 +483,311 @@ protected:
     int64_t m_head;
     int64_t m_tail;
     std::atomic_int64_t m_used_bytes;
-    int64_t m_buffer_size;
-    uint8_t* m_buffer;
+    TinyLock m_lock;
+};
 
-    SRWLOCK m_lock;
-    void* m_map;
-    HANDLE m_handle;
+// Bounded lock-free queue with a sequence number per slot, see Dmitry Vyukov's bounded MPMC queue.
+// Producers and consumers only meet at a slot, head and tail live on separate cache lines.
+// The capacity is the largest power of two of slots that fits in buffer_size. Slots store their sequence
+// number minus their index, so the zeroed pages of a new mapping are a valid empty queue and init does not
+// have to touch them.
+template <typename T>
+class TinyRingBuffer<T, TinyRingBufferMode::MPMC> : public TinyMirroredBuffer
+{
+public:
+    TinyRingBuffer()
+        : m_head(0)
+        , m_tail(0)
+        , m_slots(nullptr)
+        , m_mask(0)
+    {
+    }
+
+    TinyRingBufferStatus init(int64_t buffer_size)
+    {
+        TinyRingBufferStatus sts = map_buffer(buffer_size);
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
+
+        int64_t capacity = 1;
+        while (capacity * 2 * (int64_t)sizeof(Slot) <= m_buffer_size)
+            capacity *= 2;
+
+        m_slots = reinterpret_cast<Slot*>(m_buffer);
+        m_mask = capacity - 1;
+        m_head = 0;
+        m_tail = 0;
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    TinyRingBufferStatus free()
+    {
+        TinyRingBufferStatus sts = unmap_buffer();
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
+
+        m_slots = nullptr;
+        m_mask = 0;
+        m_head = 0;
+        m_tail = 0;
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    TinyRingBufferStatus enqueue(const T& src)
+    {
+        int64_t pos = m_head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const int64_t index = pos & m_mask;
+            Slot& slot = m_slots[index];
+            const int64_t diff = slot.sequence.load(std::memory_order_acquire) + index - pos;
+            if (diff == 0)
+            {
+                if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.value = src;
+                    slot.sequence.store(pos + 1 - index, std::memory_order_release);
+                    return TinyRingBufferStatus::SUCCESS;
+                }
+            }
+            else if (diff < 0)
+            {
+                return TinyRingBufferStatus::BUFFER_FULL;
+            }
+            else
+            {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    TinyRingBufferStatus dequeue(T* dst)
+    {
+        int64_t pos = m_tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            const int64_t index = pos & m_mask;
+            Slot& slot = m_slots[index];
+            const int64_t diff = slot.sequence.load(std::memory_order_acquire) + index - (pos + 1);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    *dst = slot.value;
+                    poison(&slot.value, (int64_t)sizeof(T));
+                    slot.sequence.store(pos + m_mask + 1 - index, std::memory_order_release);
+                    return TinyRingBufferStatus::SUCCESS;
+                }
+            }
+            else if (diff < 0)
+            {
+                return TinyRingBufferStatus::BUFFER_EMPTY;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate when called concurrently
+    int64_t count() const
+    {
+        int64_t n = m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed);
+        return n < 0 ? 0 : n;
+    }
+
+    bool empty() const
+    {
+        return count() == 0;
+    }
+
+    int64_t capacity() const
+    {
+        return m_slots == nullptr ? 0 : m_mask + 1;
+    }
+
+    // Smallest buffer_size for init() that holds at least elements
+    static int64_t buffer_size_for(int64_t elements)
+    {
+        int64_t capacity = 1;
+        while (capacity < elements)
+            capacity *= 2;
+        const int64_t byte_size = capacity * (int64_t)sizeof(Slot);
+        return (byte_size + 0xffff) & ~(int64_t)0xffff;
+    }
+
+protected:
+    struct Slot
+    {
+        std::atomic_int64_t sequence; // minus the index of the slot
+        T value;
+    };
+
+    alignas(64) std::atomic_int64_t m_head;
+    alignas(64) std::atomic_int64_t m_tail;
+    alignas(64) Slot* m_slots;
+    int64_t m_mask;
+};
+
+// Single producer, single consumer. The producer only writes m_head and the consumer only writes m_tail,
+// each side keeps a cached copy of the other side's index and only reloads it when the cache says
+// full or empty. Thanks to the mirrored mapping a batch is always one contiguous copy.
+template <typename T>
+class TinyRingBuffer<T, TinyRingBufferMode::SPSC> : public TinyMirroredBuffer
+{
+public:
+    TinyRingBuffer()
+        : m_head(0)
+        , m_head_offset(0)
+        , m_cached_tail(0)
+        , m_tail(0)
+        , m_tail_offset(0)
+        , m_cached_head(0)
+    {
+    }
+
+    TinyRingBufferStatus init(int64_t buffer_size)
+    {
+        return map_buffer(buffer_size);
+    }
+
+    TinyRingBufferStatus free()
+    {
+        TinyRingBufferStatus sts = unmap_buffer();
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
+
+        m_head = 0;
+        m_head_offset = 0;
+        m_cached_tail = 0;
+        m_tail = 0;
+        m_tail_offset = 0;
+        m_cached_head = 0;
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Producer only
+    TinyRingBufferStatus enqueue(const T& src)
+    {
+        return enqueue(&src, 1);
+    }
+
+    // Producer only
+    TinyRingBufferStatus enqueue(const T* src, int64_t elements)
+    {
+        T* dst;
+        TinyRingBufferStatus sts = reserve(elements, &dst);
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
+
+        std::copy(src, src + elements, dst);
+        return commit(elements);
+    }
+
+    // Consumer only
+    TinyRingBufferStatus dequeue(T* dst)
+    {
+        return dequeue(dst, 1);
+    }
+
+    // Consumer only
+    TinyRingBufferStatus dequeue(T* dst, int64_t elements)
+    {
+        const T* src;
+        TinyRingBufferStatus sts = peek(elements, &src);
+        if (sts != TinyRingBufferStatus::SUCCESS)
+            return sts;
+
+        std::copy(src, src + elements, dst);
+        return release(elements);
+    }
+
+    // Producer only. Zero-copy enqueue, on success *ptr points to room for elements contiguous T.
+    // Nothing is visible to the consumer until commit().
+    TinyRingBufferStatus reserve(int64_t elements, T** ptr)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        const int64_t head = m_head.load(std::memory_order_relaxed);
+        if (head + byte_size - m_cached_tail > m_buffer_size)
+        {
+            m_cached_tail = m_tail.load(std::memory_order_acquire);
+            if (head + byte_size - m_cached_tail > m_buffer_size)
+            {
+                *ptr = nullptr;
+                return TinyRingBufferStatus::BUFFER_FULL;
+            }
+        }
+
+        *ptr = reinterpret_cast<T*>(m_buffer + m_head_offset);
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Producer only. Publishes the first elements of the last reserve(), may be fewer than reserved.
+    TinyRingBufferStatus commit(int64_t elements)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        m_head_offset = advance(m_head_offset, byte_size);
+        m_head.store(m_head.load(std::memory_order_relaxed) + byte_size, std::memory_order_release);
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Consumer only. Zero-copy dequeue, on success *ptr points to elements contiguous T that stay
+    // valid until release().
+    TinyRingBufferStatus peek(int64_t elements, const T** ptr)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        const int64_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_cached_head - tail < byte_size)
+        {
+            m_cached_head = m_head.load(std::memory_order_acquire);
+            if (m_cached_head - tail < byte_size)
+            {
+                *ptr = nullptr;
+                return TinyRingBufferStatus::BUFFER_EMPTY;
+            }
+        }
+
+        *ptr = reinterpret_cast<const T*>(m_buffer + m_tail_offset);
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Consumer only. Hands the first elements of the last peek() back to the producer.
+    TinyRingBufferStatus release(int64_t elements)
+    {
+        const int64_t byte_size = (int64_t)sizeof(T) * elements;
+        poison(m_buffer + m_tail_offset, byte_size);
+        m_tail_offset = advance(m_tail_offset, byte_size);
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + byte_size, std::memory_order_release);
+        return TinyRingBufferStatus::SUCCESS;
+    }
+
+    // Approximate when called concurrently
+    int64_t count() const
+    {
+        return (m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire)) / (int64_t)sizeof(T);
+    }
+
+    bool empty() const
+    {
+        return count() == 0;
+    }
+
+protected:
+    int64_t advance(int64_t offset, int64_t byte_size) const
+    {
+        offset += byte_size;
+        return offset >= m_buffer_size ? offset - m_buffer_size : offset;
+    }
+
+    // Producer side
+    alignas(64) std::atomic_int64_t m_head; // total bytes enqueued
+    int64_t m_head_offset;
+    int64_t m_cached_tail;
+
+    // Consumer side
+    alignas(64) std::atomic_int64_t m_tail; // total bytes dequeued
+    int64_t m_tail_offset;
+    int64_t m_cached_head;
 };
 } // namespace utils
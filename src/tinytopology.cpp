@@ -0,0 +1,221 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "tinytopology.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#endif
+
+namespace utils
+{
+#ifdef _WIN32
+std::vector<TinyCpu> tiny_topology_cpus()
+{
+    std::vector<TinyCpu> cpus;
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &size);
+    std::vector<char> buffer(size);
+    auto* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)buffer.data();
+    if (size == 0 || !GetLogicalProcessorInformationEx(RelationProcessorCore, info, &size))
+        return cpus;
+
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+        process_mask = ~(DWORD_PTR)0;
+
+    int core = 0;
+    for (DWORD offset = 0; offset < size; offset += info->Size, ++core)
+    {
+        info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)(buffer.data() + offset);
+        const GROUP_AFFINITY& group = info->Processor.GroupMask[0];
+        if (group.Group != 0)
+            continue;
+
+        for (int cpu = 0; cpu < (int)(8 * sizeof(KAFFINITY)); ++cpu)
+        {
+            if ((group.Mask & process_mask) & ((KAFFINITY)1 << cpu))
+            {
+                PROCESSOR_NUMBER processor = {0, (BYTE)cpu, 0};
+                USHORT node = 0;
+                if (!GetNumaProcessorNodeEx(&processor, &node) || node == 0xffff)
+                    node = 0;
+                cpus.push_back({cpu, core, 0, (int)node});
+            }
+        }
+    }
+
+    std::sort(cpus.begin(), cpus.end(), [](const TinyCpu& a, const TinyCpu& b) { return a.cpu < b.cpu; });
+    return cpus;
+}
+
+bool tiny_topology_pin_thread(int cpu)
+{
+    if (cpu < 0 || cpu >= (int)(8 * sizeof(DWORD_PTR)))
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+}
+
+int tiny_topology_current_cpu()
+{
+    PROCESSOR_NUMBER processor;
+    GetCurrentProcessorNumberEx(&processor);
+    return processor.Group == 0 ? (int)processor.Number : -1;
+}
+#else
+namespace
+{
+int read_int(const char* path, int fallback)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+        return fallback;
+
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+        value = fallback;
+    fclose(file);
+    return value;
+}
+
+// Parses a sysfs CPU list such as "0-3,8-11"
+std::vector<int> read_cpu_list(const char* path)
+{
+    std::vector<int> list;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+        return list;
+
+    int first;
+    while (fscanf(file, "%d", &first) == 1)
+    {
+        int last = first;
+        int separator = fgetc(file);
+        if (separator == '-')
+        {
+            if (fscanf(file, "%d", &last) != 1)
+                break;
+            separator = fgetc(file);
+        }
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            list.push_back(cpu);
+
+        if (separator != ',')
+            break;
+    }
+    fclose(file);
+    return list;
+}
+} // namespace
+
+std::vector<TinyCpu> tiny_topology_cpus()
+{
+    std::vector<TinyCpu> cpus;
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return cpus;
+
+    // NUMA node of each CPU, machines without /sys/devices/system/node have one node
+    std::vector<int> node_of_cpu;
+    for (int node : read_cpu_list("/sys/devices/system/node/online"))
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        for (int cpu : read_cpu_list(path))
+        {
+            if (cpu >= (int)node_of_cpu.size())
+                node_of_cpu.resize(cpu + 1, 0);
+            node_of_cpu[cpu] = node;
+        }
+    }
+
+    std::vector<int> online = read_cpu_list("/sys/devices/system/cpu/online");
+    if (online.empty())
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            online.push_back(cpu);
+    }
+
+    for (int cpu : online)
+    {
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed))
+            continue;
+
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        const int core = read_int(path, cpu);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        const int package = read_int(path, 0);
+        const int node = cpu < (int)node_of_cpu.size() ? node_of_cpu[cpu] : 0;
+        cpus.push_back({cpu, core, package, node});
+    }
+    return cpus;
+}
+
+bool tiny_topology_pin_thread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+int tiny_topology_current_cpu()
+{
+    return sched_getcpu();
+}
+#endif
+
+std::vector<int> tiny_topology_physical_cores(const std::vector<TinyCpu>& cpus)
+{
+    std::vector<int> first_of_core;
+    std::vector<std::pair<int, int>> seen;
+    for (const TinyCpu& cpu : cpus)
+    {
+        const std::pair<int, int> core(cpu.package, cpu.core);
+        if (std::find(seen.begin(), seen.end(), core) != seen.end())
+            continue;
+
+        seen.push_back(core);
+        first_of_core.push_back(cpu.cpu);
+    }
+    return first_of_core;
+}
+} // namespace utils
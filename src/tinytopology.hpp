@@ -0,0 +1,54 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#pragma once
+
+#include <vector>
+
+namespace utils
+{
+// A logical CPU the process is allowed to run on
+struct TinyCpu
+{
+    int cpu;     // logical CPU number, as used for affinity
+    int core;    // physical core, unique within the package
+    int package; // socket
+    int node;    // NUMA node
+};
+
+// Allowed logical CPUs in ascending order. On Linux the topology is read from /sys/devices/system/cpu and
+// limited to the affinity mask of the calling thread. If sysfs is not readable every CPU counts as its
+// own core and all CPUs are in NUMA node 0. On Windows only processor group 0 is reported and all CPUs
+// are in package 0.
+std::vector<TinyCpu> tiny_topology_cpus();
+
+// The first logical CPU of each physical core, hyperthread siblings are skipped
+std::vector<int> tiny_topology_physical_cores(const std::vector<TinyCpu>& cpus);
+
+// Restricts the calling thread to one logical CPU
+bool tiny_topology_pin_thread(int cpu);
+
+// The logical CPU the calling thread runs on right now, -1 if unknown
+int tiny_topology_current_cpu();
+} // namespace utils
@@ -4033,7 +4033,7 @@ namespace {
         static bool             isSet;
         static struct sigaction oldSigActions[DOCTEST_COUNTOF(signalDefs)];
         static stack_t          oldSigStack;
-        static char             altStackMem[4 * SIGSTKSZ];
+        static char             altStackMem[4 * 16384]; // SIGSTKSZ is not a constant since glibc 2.34
 
         static void handleSignal(int sig) {
             const char* name = "<unknown signal>";
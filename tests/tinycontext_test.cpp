@@ -0,0 +1,97 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <tinycontext.hpp>
+
+#include "doctest.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+using utils::TinyContext;
+
+namespace
+{
+const size_t CONTEXT_STACK_SIZE = 64 * 1024;
+const int64_t CONTEXT_SWITCH_ROUNDS = 10000000;
+
+struct PingPong
+{
+    TinyContext main_context;
+    TinyContext job_context;
+    int64_t counter;
+    double fraction;
+};
+
+void ping_pong_job(void* param)
+{
+    PingPong& pp = *(PingPong*)param;
+    while (true)
+    {
+        pp.counter++;
+        pp.fraction *= 0.5;
+        utils::tiny_context_switch(&pp.job_context, &pp.main_context);
+    }
+}
+} // namespace
+
+TEST_CASE("tinycontext switch")
+{
+    // Given
+    std::vector<uint8_t> stack(CONTEXT_STACK_SIZE);
+    PingPong pp{};
+    pp.fraction = 1024.0;
+    utils::tiny_context_make(&pp.job_context, stack.data(), stack.size(), ping_pong_job, &pp);
+
+    // When
+    for (int i = 0; i < 10; ++i)
+        utils::tiny_context_switch(&pp.main_context, &pp.job_context);
+
+    // Then
+    CHECK(pp.counter == 10);
+    CHECK(pp.fraction == 1.0);
+}
+
+TEST_CASE("tinycontext performance")
+{
+    std::vector<uint8_t> stack(CONTEXT_STACK_SIZE);
+    PingPong pp{};
+    utils::tiny_context_make(&pp.job_context, stack.data(), stack.size(), ping_pong_job, &pp);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int64_t i = 0; i < CONTEXT_SWITCH_ROUNDS; ++i)
+        utils::tiny_context_switch(&pp.main_context, &pp.job_context);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    CHECK(pp.counter == CONTEXT_SWITCH_ROUNDS);
+
+    // Two switches per round
+    double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+    std::cout << "Context switch: " << std::endl;
+    std::cout << "Time: " << ns / 1000.0 << std::endl;
+    std::cout << "ns/switch: " << ns / (2.0 * CONTEXT_SWITCH_ROUNDS) << std::endl;
+    std::cout << std::endl;
+}
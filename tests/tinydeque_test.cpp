@@ -0,0 +1,260 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <tinydeque.hpp>
+
+#include "doctest.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+using utils::TinyDequeStatus;
+using utils::TinyRunNextSlot;
+using utils::TinyWorkStealingDeque;
+
+namespace
+{
+struct JobLike
+{
+    void* a;
+    int64_t b;
+    void* c;
+};
+
+static const int DEQUE_SIZE = 1024;
+} // namespace
+
+TEST_CASE("tinydeque init")
+{
+    // Given
+    TinyWorkStealingDeque<int64_t> dq;
+
+    // When
+    TinyDequeStatus sts = dq.init(DEQUE_SIZE);
+
+    // Then
+    CHECK(sts == TinyDequeStatus::SUCCESS);
+    CHECK(dq.capacity() == DEQUE_SIZE);
+    CHECK(dq.empty());
+    CHECK(dq.init(1000) == TinyDequeStatus::INVALID_ARGUMENT);
+}
+
+TEST_CASE("tinydeque owner is lifo and thief is fifo")
+{
+    // Given
+    TinyWorkStealingDeque<JobLike> dq;
+    REQUIRE(dq.init(DEQUE_SIZE) == TinyDequeStatus::SUCCESS);
+    for (int64_t i = 0; i < 4; ++i)
+        REQUIRE(dq.push(JobLike{nullptr, i, nullptr}) == TinyDequeStatus::SUCCESS);
+
+    // When
+    JobLike popped{};
+    JobLike stolen{};
+    TinyDequeStatus pop_sts = dq.pop(&popped);
+    TinyDequeStatus steal_sts = dq.steal(&stolen);
+
+    // Then
+    CHECK(pop_sts == TinyDequeStatus::SUCCESS);
+    CHECK(steal_sts == TinyDequeStatus::SUCCESS);
+    CHECK(popped.b == 3);
+    CHECK(stolen.b == 0);
+    CHECK(dq.count() == 2);
+}
+
+TEST_CASE("tinydeque full and empty")
+{
+    // Given
+    TinyWorkStealingDeque<int64_t> dq;
+    REQUIRE(dq.init(DEQUE_SIZE) == TinyDequeStatus::SUCCESS);
+
+    // When
+    for (int64_t i = 0; i < DEQUE_SIZE; ++i)
+        REQUIRE(dq.push(i) == TinyDequeStatus::SUCCESS);
+    TinyDequeStatus full_sts = dq.push(0);
+
+    int64_t d;
+    for (int64_t i = 0; i < DEQUE_SIZE; ++i)
+        REQUIRE(dq.pop(&d) == TinyDequeStatus::SUCCESS);
+    TinyDequeStatus empty_pop_sts = dq.pop(&d);
+    TinyDequeStatus empty_steal_sts = dq.steal(&d);
+
+    // Then
+    CHECK(full_sts == TinyDequeStatus::FULL);
+    CHECK(empty_pop_sts == TinyDequeStatus::EMPTY);
+    CHECK(empty_steal_sts == TinyDequeStatus::EMPTY);
+}
+
+TEST_CASE("tinydeque concurrent steal")
+{
+    // Given
+    TinyWorkStealingDeque<int64_t> dq;
+    REQUIRE(dq.init(DEQUE_SIZE) == TinyDequeStatus::SUCCESS);
+    const int64_t elements = 200000;
+    std::atomic_bool done(false);
+    std::atomic_int64_t sum(0);
+    std::atomic_int64_t taken(0);
+
+    // When
+    std::thread thieves[3];
+    for (int t = 0; t < 3; ++t)
+    {
+        thieves[t] = std::thread([&] {
+            int64_t d;
+            while (!done || !dq.empty())
+            {
+                if (dq.steal(&d) == TinyDequeStatus::SUCCESS)
+                {
+                    sum += d;
+                    taken++;
+                }
+            }
+        });
+    }
+
+    for (int64_t i = 1; i <= elements; ++i)
+    {
+        while (dq.push(i) != TinyDequeStatus::SUCCESS)
+        {
+            int64_t d;
+            if (dq.pop(&d) == TinyDequeStatus::SUCCESS)
+            {
+                sum += d;
+                taken++;
+            }
+        }
+    }
+
+    int64_t d;
+    while (dq.pop(&d) == TinyDequeStatus::SUCCESS)
+    {
+        sum += d;
+        taken++;
+    }
+    done = true;
+
+    for (int t = 0; t < 3; ++t)
+        thieves[t].join();
+
+    // Then
+    CHECK(taken == elements);
+    CHECK(sum == elements * (elements + 1) / 2);
+}
+
+TEST_CASE("tinydeque run next slot")
+{
+    // Given
+    TinyRunNextSlot<JobLike> slot;
+    JobLike displaced{};
+    JobLike taken{};
+
+    // When
+    TinyDequeStatus first_sts = slot.put(JobLike{nullptr, 1, nullptr}, &displaced);
+    TinyDequeStatus second_sts = slot.put(JobLike{nullptr, 2, nullptr}, &displaced);
+    TinyDequeStatus take_sts = slot.take(&taken);
+    TinyDequeStatus empty_sts = slot.take(&taken);
+
+    // Then
+    CHECK(first_sts == TinyDequeStatus::SUCCESS);
+    CHECK(second_sts == TinyDequeStatus::FULL);
+    CHECK(displaced.b == 1);
+    CHECK(take_sts == TinyDequeStatus::SUCCESS);
+    CHECK(taken.b == 2);
+    CHECK(empty_sts == TinyDequeStatus::EMPTY);
+    CHECK(slot.empty());
+}
+
+TEST_CASE("tinydeque run next slot steals only the element it saw")
+{
+    // Given
+    TinyRunNextSlot<JobLike> slot;
+    JobLike displaced{};
+    JobLike stolen{};
+    slot.put(JobLike{nullptr, 1, nullptr}, &displaced);
+    const uint64_t seen = slot.version();
+
+    // When
+    slot.put(JobLike{nullptr, 2, nullptr}, &displaced);
+    TinyDequeStatus stale_sts = slot.steal(&stolen, seen);
+    TinyDequeStatus steal_sts = slot.steal(&stolen, slot.version());
+    TinyDequeStatus empty_sts = slot.steal(&stolen, slot.version());
+
+    // Then
+    CHECK(stale_sts == TinyDequeStatus::ABORT);
+    CHECK(steal_sts == TinyDequeStatus::SUCCESS);
+    CHECK(stolen.b == 2);
+    CHECK(empty_sts == TinyDequeStatus::EMPTY);
+}
+
+TEST_CASE("tinydeque run next slot concurrent steal")
+{
+    // Given
+    TinyRunNextSlot<int64_t> slot;
+    const int64_t elements = 200000;
+    std::atomic_bool done(false);
+    std::atomic_int64_t sum(0);
+    std::atomic_int64_t taken(0);
+
+    // When
+    std::thread thieves[3];
+    for (int t = 0; t < 3; ++t)
+    {
+        thieves[t] = std::thread([&] {
+            int64_t d;
+            while (!done || !slot.empty())
+            {
+                if (slot.steal(&d, slot.version()) == TinyDequeStatus::SUCCESS)
+                {
+                    sum += d;
+                    taken++;
+                }
+            }
+        });
+    }
+
+    for (int64_t i = 1; i <= elements; ++i)
+    {
+        int64_t displaced;
+        if (slot.put(i, &displaced) == TinyDequeStatus::FULL)
+        {
+            sum += displaced;
+            taken++;
+        }
+    }
+
+    int64_t d;
+    if (slot.take(&d) == TinyDequeStatus::SUCCESS)
+    {
+        sum += d;
+        taken++;
+    }
+    done = true;
+
+    for (int t = 0; t < 3; ++t)
+        thieves[t].join();
+
+    // Then
+    CHECK(taken == elements);
+    CHECK(sum == elements * (elements + 1) / 2);
+}
@@ -0,0 +1,59 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Compiled as C, tinyfiber.h must stay usable from C */
+#include <tinyfiber.h>
+
+static void c_count_job(void* param)
+{
+    ++*(int*)param;
+}
+
+int tfb_c_api_count_jobs(int jobs)
+{
+    TfbContext* fs = NULL;
+    TfbWaitHandle wh = {0};
+    int counter = 0;
+    int i;
+
+    /* One worker, the counter is not atomic */
+    if (tfb_init_ext(&fs, 1) != 0)
+        return -1;
+
+    for (i = 0; i < jobs; ++i)
+    {
+        TfbJobDeclaration jd = {0};
+        jd.func = c_count_job;
+        jd.user_data = &counter;
+        jd.wait_handle = &wh;
+        jd.stack_class = TFB_STACK_SMALL;
+        jd.priority = TFB_PRIORITY_NORMAL;
+        if (tfb_add_jobdecl_ext(fs, &jd) != 0)
+            break;
+    }
+
+    tfb_await_ext(fs, &wh);
+    tfb_free_ext(&fs);
+    return counter;
+}
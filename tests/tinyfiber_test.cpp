@@ -23,14 +23,38 @@ SOFTWARE.
 */
 
 #include <tinyfiber.h>
+#include <tinytopology.hpp>
 
 #include "doctest.hpp"
+#include <algorithm>
 #include <atomic>
 #include <thread>
 #include <sstream>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+extern "C" int tfb_c_api_count_jobs(int jobs);
 
 namespace tinyfiber
 {
+// pthread_self() is declared const, read it through a volatile pointer since we change thread under its feet
+std::thread::id current_thread_id()
+{
+    static std::thread::id (*volatile get_id)() = std::this_thread::get_id;
+    return get_id();
+}
+
 void recursive_job(void* param)
 {
     if (param == nullptr)
@@ -57,12 +81,17 @@ void recursive_job(void* param)
     CHECK((int64_t)d == 0);
 }
 
+TEST_CASE("tinyfiber C API")
+{
+    CHECK(tfb_c_api_count_jobs(100) == 100);
+}
+
 TEST_CASE("tinyfiber init/deinit simple")
 {
     // Given
-    auto start_id = std::this_thread::get_id();
+    auto start_id = current_thread_id();
     REQUIRE(tfb_init() == 0);
-    auto run_id = std::this_thread::get_id();
+    auto run_id = current_thread_id();
 
     // When
     int sts = tfb_free();
@@ -74,7 +103,7 @@ TEST_CASE("tinyfiber init/deinit simple")
     ss_run_id << run_id;
     CHECK(ss_start_id.str() != ss_run_id.str());
     std::stringstream ss_now_id;
-    ss_now_id << std::this_thread::get_id();
+    ss_now_id << current_thread_id();
     CHECK(ss_now_id.str() == ss_start_id.str());
     CHECK(sts == 0);
 }
@@ -87,9 +116,10 @@ TEST_CASE("tinyfiber init ext")
     // When
     int sts = tfb_init_ext(&fs, TFB_ALL_CORES);
 
-    // Then
+    // Then, one worker per hardware thread
     CHECK(sts == 0);
     CHECK(fs != nullptr);
+    CHECK(tfb_active_workers_ext(fs) == (int)std::max(1u, std::thread::hardware_concurrency()));
 
     // Cleanup
     REQUIRE(tfb_free_ext(&fs) == 0);
@@ -109,6 +139,535 @@ TEST_CASE("tinyfiber deinit ext")
     CHECK(fs == nullptr);
 }
 
+TEST_CASE("tinyfiber init decl ext")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 1;
+    init_declaration.prewarm_fibers = 16;
+
+    // When
+    int sts = tfb_init_decl_ext(&fs, &init_declaration);
+    std::atomic_int64_t depth(64);
+    recursive_job(&depth);
+
+    // Then
+    CHECK(sts == 0);
+    CHECK(fs != nullptr);
+    CHECK(depth == 0);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+TEST_CASE("tinyfiber init rejects invalid worker counts")
+{
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+
+    SUBCASE("negative max threads")
+    {
+        init_declaration.max_threads = -1;
+    }
+
+    SUBCASE("negative min active workers")
+    {
+        init_declaration.min_active_workers = -1;
+    }
+
+    SUBCASE("more min active workers than workers")
+    {
+        init_declaration.max_threads = 2;
+        init_declaration.min_active_workers = 3;
+    }
+
+    CHECK(tfb_init_decl_ext(&fs, &init_declaration) == -1);
+    CHECK(fs == nullptr);
+}
+
+TEST_CASE("tinyfiber init failure leaves no context behind")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 1;
+    init_declaration.prewarm_fibers = 4;
+    init_declaration.stack_sizes[TFB_STACK_DEFAULT] = (size_t)1 << 62;
+
+    // When
+    int sts = tfb_init_decl_ext(&fs, &init_declaration);
+
+    // Then
+    CHECK(sts == -1);
+    CHECK(fs == nullptr);
+    CHECK(tfb_free_ext(&fs) == -1);
+    REQUIRE(tfb_init_ext(&fs, 1) == 0);
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+TEST_CASE("tinyfiber await chain deeper than the initial pool")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    REQUIRE(tfb_init_ext(&fs, 1) == 0);
+    std::atomic_int64_t depth(4096);
+
+    // When
+    recursive_job(&depth);
+
+    // Then
+    CHECK(depth == 0);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+TEST_CASE("tinyfiber pool grows in chunks and trims idle fibers")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 2;
+    init_declaration.max_fibers = 256;
+    init_declaration.fiber_grow_chunk = 3;
+    init_declaration.max_idle_fibers = 4;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When
+    for (int round = 0; round < 4; ++round)
+    {
+        std::atomic_int64_t depth(128);
+        recursive_job(&depth);
+
+        // Then
+        CHECK(depth == 0);
+    }
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void small_stack_chain_job(void* param)
+{
+    std::atomic_int64_t* depth = (std::atomic_int64_t*)param;
+    if (--(*depth) <= 0)
+        return;
+
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jd{};
+    jd.func = small_stack_chain_job;
+    jd.user_data = param;
+    jd.wait_handle = &wh;
+    jd.stack_class = TFB_STACK_SMALL;
+
+    tfb_add_jobdecl(&jd);
+    tfb_await(&wh);
+}
+
+void large_stack_job(void* param)
+{
+    volatile char buffer[256 * 1024];
+    for (size_t i = 0; i < sizeof(buffer); i += 1024)
+        buffer[i] = 1;
+    *(std::atomic_int*)param += buffer[sizeof(buffer) - 1024];
+}
+
+void spawn_large_stack_job(void* param)
+{
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jd{};
+    jd.func = large_stack_job;
+    jd.user_data = param;
+    jd.wait_handle = &wh;
+    jd.stack_class = TFB_STACK_DEFAULT;
+
+    tfb_add_jobdecl(&jd);
+    tfb_await(&wh);
+}
+
+struct ClassChain
+{
+    std::atomic_int64_t depth;
+    std::atomic_int failed_awaits;
+};
+
+// The frame takes more than half of the stack class, so the child can not run inline on it
+template <int StackClass, size_t FrameSize>
+void class_chain_job(void* param)
+{
+    volatile char frame[FrameSize];
+    frame[0] = 1;
+    frame[FrameSize - 1] = 1;
+
+    ClassChain& chain = *(ClassChain*)param;
+    if ((chain.depth -= frame[0] * frame[FrameSize - 1]) <= 0)
+        return;
+
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jd = {class_chain_job<StackClass, FrameSize>, param, &wh, StackClass};
+    if (tfb_add_jobdecl(&jd) != 0 || tfb_await(&wh) != 0)
+        chain.failed_awaits++;
+}
+
+TEST_CASE("tinyfiber stack classes share max_fibers")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_fibers = 64;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When a medium chain leaves its fibers idle in the pool and a small chain needs the budget
+    ClassChain medium{{40}, {0}};
+    class_chain_job<TFB_STACK_MEDIUM, 40 * 1024>(&medium);
+    ClassChain small{{40}, {0}};
+    class_chain_job<TFB_STACK_SMALL, 10 * 1024>(&small);
+
+    // Then
+    CHECK(medium.depth == 0);
+    CHECK(medium.failed_awaits == 0);
+    CHECK(small.depth == 0);
+    CHECK(small.failed_awaits == 0);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+TEST_CASE("tinyfiber stack classes")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 2;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    SUBCASE("deep chain of small stack fibers")
+    {
+        // When
+        std::atomic_int64_t depth(10000);
+        TfbWaitHandle wh{};
+        TfbJobDeclaration jd{};
+        jd.func = small_stack_chain_job;
+        jd.user_data = &depth;
+        jd.wait_handle = &wh;
+        jd.stack_class = TFB_STACK_SMALL;
+        REQUIRE(tfb_add_jobdecl(&jd) == 0);
+        REQUIRE(tfb_await(&wh) == 0);
+
+        // Then
+        CHECK(depth == 0);
+    }
+
+    SUBCASE("large stack job spawned from small stack jobs")
+    {
+        // When
+        std::atomic_int sum(0);
+        TfbWaitHandle wh{};
+        TfbJobDeclaration jds[16];
+        for (auto& jd : jds)
+            jd = {spawn_large_stack_job, &sum, &wh, TFB_STACK_SMALL};
+        REQUIRE(tfb_add_jobdecls(jds, 16) == 0);
+        REQUIRE(tfb_await(&wh) == 0);
+
+        // Then
+        CHECK(sum == 16);
+    }
+
+    SUBCASE("unknown stack class")
+    {
+        // When
+        TfbJobDeclaration jd{};
+        jd.func = large_stack_job;
+        jd.stack_class = TFB_NUMBER_OF_STACK_CLASSES;
+
+        // Then
+        CHECK(tfb_add_jobdecl(&jd) != 0);
+    }
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+#ifndef _WIN32
+__attribute__((noinline)) int overflow_stack(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = (char)depth;
+    volatile bool recurse = true; // always, the compiler just can not tell
+    if (!recurse)
+        return frame[0];
+    return overflow_stack(depth + 1) + frame[0];
+}
+
+void stack_overflow_job(void*)
+{
+    overflow_stack(0);
+}
+
+TEST_CASE("tinyfiber stack overflow is reported")
+{
+    // Given
+    int pipe_fds[2];
+    REQUIRE(pipe(pipe_fds) == 0);
+
+    // When
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0)
+    {
+        dup2(pipe_fds[1], STDERR_FILENO);
+        TfbInitDeclaration init_declaration{};
+        init_declaration.max_threads = 1;
+        init_declaration.stack_sizes[TFB_STACK_DEFAULT] = 32 * 1024;
+        tfb_init_decl_ext(nullptr, &init_declaration);
+
+        TfbWaitHandle wh{};
+        TfbJobDeclaration jd{};
+        jd.func = stack_overflow_job;
+        jd.wait_handle = &wh;
+        tfb_add_jobdecl(&jd);
+        tfb_await(&wh);
+        _exit(0);
+    }
+    close(pipe_fds[1]);
+
+    std::string report;
+    char buffer[256];
+    ssize_t n;
+    while ((n = read(pipe_fds[0], buffer, sizeof(buffer))) > 0)
+        report.append(buffer, (size_t)n);
+    close(pipe_fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    // Then
+    char expected[128];
+    snprintf(expected,
+             sizeof(expected),
+             "stack overflow in job 0x%llx, fiber stack is %d bytes",
+             (unsigned long long)(uintptr_t)stack_overflow_job,
+             32 * 1024);
+    CHECK(WIFSIGNALED(status));
+    CHECK(WTERMSIG(status) == SIGSEGV);
+    CHECK(report.find(expected) != std::string::npos);
+}
+#endif
+
+void deep_stack_job(void* param)
+{
+    volatile char buffer[32 * 1024];
+    for (size_t i = 0; i < sizeof(buffer); i += 64)
+        buffer[i] = 1;
+    *(std::atomic_int*)param += buffer[0];
+}
+
+void shallow_stack_job(void* param)
+{
+    *(std::atomic_int*)param += 1;
+}
+
+TEST_CASE("tinyfiber stack usage")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 2;
+    init_declaration.track_stack_usage = 1;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When
+    std::atomic_int sum(0);
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jds[64];
+    for (int i = 0; i < 64; ++i)
+        jds[i] = {i % 2 == 0 ? deep_stack_job : shallow_stack_job, &sum, &wh, TFB_STACK_DEFAULT};
+    REQUIRE(tfb_add_jobdecls(jds, 64) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+
+    TfbStackUsage usage[8];
+    int64_t functions = tfb_stack_usage_ext(fs, usage, 8);
+
+    // Then
+    CHECK(sum == 64);
+#ifdef _WIN32
+    CHECK(functions == 0);
+#else
+    REQUIRE(functions == 2);
+    for (int64_t i = 0; i < functions; ++i)
+    {
+        CHECK(usage[i].calls == 32);
+        CHECK(usage[i].p50_stack_usage <= usage[i].p99_stack_usage);
+        CHECK(usage[i].p99_stack_usage <= usage[i].max_stack_usage);
+        if (usage[i].func == deep_stack_job)
+        {
+            CHECK(usage[i].max_stack_usage >= 32 * 1024);
+            CHECK(usage[i].max_stack_usage < 40 * 1024);
+            CHECK(usage[i].p50_stack_usage >= 32 * 1024);
+        }
+        else
+        {
+            CHECK(usage[i].func == shallow_stack_job);
+            CHECK(usage[i].max_stack_usage < 8 * 1024);
+        }
+    }
+#endif
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void add_and_run_deep_job(void* param)
+{
+    TfbWaitHandle wh{};
+    TfbJobDeclaration last = {deep_stack_job, param, &wh, TFB_STACK_DEFAULT};
+    tfb_add_and_run(&last, 1);
+    tfb_await(&wh);
+}
+
+TEST_CASE("tinyfiber stack usage of jobs run inline")
+{
+    // Given
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 1;
+    init_declaration.track_stack_usage = 1;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When
+    std::atomic_int sum(0);
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jd = {add_and_run_deep_job, &sum, &wh, TFB_STACK_DEFAULT};
+    REQUIRE(tfb_add_jobdecl(&jd) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+
+    TfbStackUsage usage[8];
+    int64_t functions = tfb_stack_usage_ext(fs, usage, 8);
+
+    // Then
+    CHECK(sum == 1);
+#ifdef _WIN32
+    CHECK(functions == 0);
+#else
+    REQUIRE(functions == 2);
+    for (int64_t i = 0; i < functions; ++i)
+    {
+        CHECK(usage[i].calls == 1);
+        CHECK(usage[i].max_stack_usage >= 32 * 1024);
+        if (usage[i].func == deep_stack_job)
+            CHECK(usage[i].max_stack_usage < 40 * 1024);
+        else
+            CHECK(usage[i].func == add_and_run_deep_job); // counts the inline job on its stack too
+    }
+#endif
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+#ifndef _WIN32
+size_t resident_bytes()
+{
+    long pages = 0;
+    long resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr)
+        return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+void touch_stack_chain_job(void* param)
+{
+    volatile char buffer[48 * 1024];
+    for (size_t i = 0; i < sizeof(buffer); i += 4096)
+        buffer[i] = 1;
+
+    std::atomic_int64_t* depth = (std::atomic_int64_t*)param;
+    if (--(*depth) > 0)
+    {
+        TfbWaitHandle wh{};
+        TfbJobDeclaration jd = {touch_stack_chain_job, param, &wh, TFB_STACK_MEDIUM};
+        tfb_add_jobdecl(&jd);
+        tfb_await(&wh);
+    }
+}
+
+// Returns how much the resident set grew by a spike of 512 fibers with 48 KiB of touched stack each.
+// Too little is left of their 64 KiB stacks to run the next job inline.
+size_t measure_idle_trim(const char* name, int resident_idle_fibers)
+{
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 1;
+    init_declaration.resident_idle_fibers = resident_idle_fibers;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    const size_t rss_before = resident_bytes();
+    auto start = std::chrono::high_resolution_clock::now();
+    std::atomic_int64_t depth(512);
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jd = {touch_stack_chain_job, &depth, &wh, TFB_STACK_MEDIUM};
+    REQUIRE(tfb_add_jobdecl(&jd) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+    auto stop = std::chrono::high_resolution_clock::now();
+    const size_t rss_after = resident_bytes();
+
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    const size_t growth = rss_after > rss_before ? rss_after - rss_before : 0;
+    std::cout << name << std::endl;
+    std::cout << "Time: " << std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() << std::endl;
+    std::cout << "RSS before: " << rss_before / 1024 << " KiB" << std::endl;
+    std::cout << "RSS after: " << rss_after / 1024 << " KiB" << std::endl;
+    return growth;
+}
+
+TEST_CASE("tinyfiber idle stack trim")
+{
+    // Given a spike of fibers that all return to the pool
+
+    // When
+    const size_t kept = measure_idle_trim("Idle stacks, no trim: ", -1);
+    const size_t trimmed = measure_idle_trim("Idle stacks, trim beyond 64: ", 64);
+
+    // Then
+    CHECK(kept >= 512 * 48 * 1024);
+    CHECK(trimmed < kept / 2);
+}
+#endif
+
+void measure_init_free(const char* name, int prewarm_fibers)
+{
+    const int rounds = 50;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.prewarm_fibers = prewarm_fibers;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < rounds; ++i)
+    {
+        TfbContext* fs = nullptr;
+        REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+        REQUIRE(tfb_free_ext(&fs) == 0);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << name << std::endl;
+    std::cout << "Time: " << us << std::endl;
+    std::cout << "us/init+free: " << us / rounds << std::endl;
+    std::cout << std::endl;
+}
+
+TEST_CASE("tinyfiber init/free latency")
+{
+    measure_init_free("Init and free, lazy fibers: ", 0);
+    measure_init_free("Init and free, 1024 prewarmed fibers: ", 1024);
+}
+
 TEST_CASE("tinyfiber run 1 core")
 {
     //Given
@@ -171,6 +730,844 @@ TEST_CASE("tinyfiber mt consistency")
     CHECK(depth1 == depth2);
 }
 
+struct SplitRange
+{
+    int64_t begin;
+    int64_t end;
+    std::atomic_int64_t* sum;
+};
+
+void split_job(void* param)
+{
+    SplitRange& range = *(SplitRange*)param;
+    if (range.end - range.begin <= 16)
+    {
+        int64_t sum = 0;
+        for (int64_t i = range.begin; i < range.end; ++i)
+            sum += i;
+        *range.sum += sum;
+        return;
+    }
+
+    int64_t mid = range.begin + (range.end - range.begin) / 2;
+    SplitRange halves[2] = {{range.begin, mid, range.sum}, {mid, range.end, range.sum}};
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jobs[2] = {{split_job, &halves[0], &wh}, {split_job, &halves[1], &wh}};
+    tfb_add_jobdecls(jobs, 2);
+    tfb_await(&wh);
+}
+
+void split_add_and_run_job(void* param)
+{
+    SplitRange& range = *(SplitRange*)param;
+    if (range.end - range.begin <= 16)
+    {
+        int64_t sum = 0;
+        for (int64_t i = range.begin; i < range.end; ++i)
+            sum += i;
+        *range.sum += sum;
+        return;
+    }
+
+    int64_t mid = range.begin + (range.end - range.begin) / 2;
+    SplitRange halves[2] = {{range.begin, mid, range.sum}, {mid, range.end, range.sum}};
+    TfbWaitHandle wh{};
+    TfbJobDeclaration jobs[2] = {{split_add_and_run_job, &halves[0], &wh}, {split_add_and_run_job, &halves[1], &wh}};
+    tfb_add_and_run(jobs, 2);
+    tfb_await(&wh);
+}
+
+TEST_CASE("tinyfiber fork join")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, TFB_ALL_CORES) == 0);
+    std::atomic_int64_t sum(0);
+    SplitRange range = {0, 100000, &sum};
+
+    // When
+    SUBCASE("add and await")
+    {
+        split_job(&range);
+    }
+
+    SUBCASE("add and run")
+    {
+        split_add_and_run_job(&range);
+    }
+
+    // Then
+    CHECK(sum == (int64_t)100000 * 99999 / 2);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+struct StackAddresses
+{
+    uintptr_t parent;
+    uintptr_t child;
+};
+
+void record_child_stack_job(void* param)
+{
+    volatile char marker = 0;
+    ((StackAddresses*)param)->child = (uintptr_t)&marker;
+}
+
+void await_child_job(void* param)
+{
+    volatile char marker = 0;
+    ((StackAddresses*)param)->parent = (uintptr_t)&marker;
+
+    TfbWaitHandle wh{};
+    tfb_add_job(record_child_stack_job, param, &wh);
+    tfb_await(&wh);
+}
+
+TEST_CASE("tinyfiber await runs the awaited job inline")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, 1) == 0);
+    StackAddresses addresses = {0, 0};
+
+    // When
+    TfbWaitHandle wh{};
+    REQUIRE(tfb_add_job(await_child_job, &addresses, &wh) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then the child ran right below the parent, on the same stack
+    CHECK(addresses.child < addresses.parent);
+    CHECK(addresses.parent - addresses.child < 16 * 1024);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void measure_fork_join(const char* name, int max_threads, void (*split)(void*))
+{
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, max_threads) == 0);
+    std::atomic_int64_t sum(0);
+    const int64_t elements = 1 << 20;
+    SplitRange range = {0, elements, &sum};
+
+    auto start = std::chrono::high_resolution_clock::now();
+    split(&range);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    CHECK(sum == elements * (elements - 1) / 2);
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << name << std::endl;
+    std::cout << "Time: " << us << std::endl;
+    std::cout << "ns/job: " << us * 1000 / (elements / 16 * 2) << std::endl;
+}
+
+TEST_CASE("tinyfiber fork join performance")
+{
+    measure_fork_join("Fork join, 1 thread: ", 1, split_job);
+    measure_fork_join("Fork join, all threads: ", TFB_ALL_CORES, split_job);
+    measure_fork_join("Fork join add and run, 1 thread: ", 1, split_add_and_run_job);
+    measure_fork_join("Fork join add and run, all threads: ", TFB_ALL_CORES, split_add_and_run_job);
+}
+
+TEST_CASE("tinyfiber scaling")
+{
+    const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int threads = 1;; threads = std::min(threads * 2, hardware_threads))
+    {
+        const std::string name = "Fork join, " + std::to_string(threads) + " threads: ";
+        measure_fork_join(name.c_str(), threads, split_job);
+        if (threads == hardware_threads)
+            break;
+    }
+}
+
+struct PipelineState
+{
+    std::vector<int64_t> data;
+    int64_t stages_left;
+    TfbWaitHandle* wait_handle;
+};
+
+// Each stage works on the data of the previous one and then hands it on to the next stage
+void pipeline_stage_job(void* param)
+{
+    PipelineState& state = *(PipelineState*)param;
+    for (int64_t& value : state.data)
+        value++;
+
+    if (--state.stages_left > 0)
+        tfb_add_job(pipeline_stage_job, param, state.wait_handle);
+}
+
+TEST_CASE("tinyfiber pipeline performance")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, TFB_ALL_CORES) == 0);
+    const int pipelines = 8;
+    const int64_t stages = 2000;
+    TfbWaitHandle wh{};
+    PipelineState states[pipelines];
+    for (PipelineState& state : states)
+        state = {std::vector<int64_t>(8 * 1024), stages, &wh};
+
+    // When
+    auto start = std::chrono::high_resolution_clock::now();
+    for (PipelineState& state : states)
+        REQUIRE(tfb_add_job(pipeline_stage_job, &state, &wh) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+    auto stop = std::chrono::high_resolution_clock::now();
+
+    // Then
+    for (PipelineState& state : states)
+    {
+        CHECK(state.data.front() == stages);
+        CHECK(state.data.back() == stages);
+    }
+
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << "Pipeline, 8 x 2000 stages over 64 KiB: " << std::endl;
+    std::cout << "Time: " << us << std::endl;
+    std::cout << "ns/stage: " << us * 1000 / (pipelines * stages) << std::endl;
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void count_job(void* param)
+{
+    (*(std::atomic_int64_t*)param)++;
+}
+
+void spin_for(std::chrono::microseconds duration)
+{
+    auto end = std::chrono::high_resolution_clock::now() + duration;
+    while (std::chrono::high_resolution_clock::now() < end)
+    {
+    }
+}
+
+void slow_count_job(void* param)
+{
+    spin_for(std::chrono::microseconds(5));
+    (*(std::atomic_int64_t*)param)++;
+}
+
+struct ProbeState
+{
+    std::atomic_int64_t* counter;
+    int64_t counter_at_start;
+    std::chrono::high_resolution_clock::time_point added;
+    std::chrono::high_resolution_clock::time_point started;
+};
+
+void probe_job(void* param)
+{
+    ProbeState& probe = *(ProbeState*)param;
+    probe.started = std::chrono::high_resolution_clock::now();
+    probe.counter_at_start = probe.counter->load();
+}
+
+TEST_CASE("tinyfiber low priority is not starved")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, 1) == 0);
+    std::atomic_int64_t counter(0);
+    ProbeState probe{&counter, -1};
+    TfbWaitHandle wh{};
+
+    // When, the low priority job is added after 1000 normal jobs
+    std::thread producer([&] {
+        for (int i = 0; i < 1000; ++i)
+        {
+            TfbJobDeclaration jd = {slow_count_job, &counter, &wh};
+            while (tfb_add_jobdecl_ext(fs, &jd) != 0)
+                std::this_thread::yield();
+        }
+        TfbJobDeclaration low = {probe_job, &probe, &wh, TFB_STACK_DEFAULT, TFB_PRIORITY_LOW};
+        while (tfb_add_jobdecl_ext(fs, &low) != 0)
+            std::this_thread::yield();
+    });
+    producer.join();
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then
+    CHECK(counter == 1000);
+    CHECK(probe.counter_at_start >= 0);
+    CHECK(probe.counter_at_start < 900);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void measure_priority_latency(const char* name, int background_priority, int probe_priority)
+{
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, TFB_ALL_CORES) == 0);
+    std::atomic_int64_t counter(0);
+    ProbeState probes[10];
+    TfbWaitHandle wh{};
+
+    // Background load from another thread saturates the workers, probes are added in between
+    std::thread producer([&] {
+        for (int i = 0; i < 2000; ++i)
+        {
+            TfbJobDeclaration jd = {slow_count_job, &counter, &wh, TFB_STACK_DEFAULT, background_priority};
+            while (tfb_add_jobdecl_ext(fs, &jd) != 0)
+                std::this_thread::yield();
+
+            if (i % 200 == 100)
+            {
+                ProbeState& probe = probes[i / 200];
+                probe = {&counter, -1, std::chrono::high_resolution_clock::now()};
+                TfbJobDeclaration probe_jd = {probe_job, &probe, &wh, TFB_STACK_DEFAULT, probe_priority};
+                while (tfb_add_jobdecl_ext(fs, &probe_jd) != 0)
+                    std::this_thread::yield();
+            }
+        }
+    });
+    producer.join();
+    REQUIRE(tfb_await(&wh) == 0);
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    double max_us = 0;
+    double sum_us = 0;
+    for (const ProbeState& probe : probes)
+    {
+        const double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(probe.started - probe.added).count();
+        max_us = std::max(max_us, us);
+        sum_us += us;
+    }
+    std::cout << name << std::endl;
+    std::cout << "Mean latency us: " << sum_us / 10 << std::endl;
+    std::cout << "Max latency us: " << max_us << std::endl;
+}
+
+TEST_CASE("tinyfiber priority latency")
+{
+    measure_priority_latency("Probe latency, normal behind normal: ", TFB_PRIORITY_NORMAL, TFB_PRIORITY_NORMAL);
+    measure_priority_latency("Probe latency, high behind normal: ", TFB_PRIORITY_NORMAL, TFB_PRIORITY_HIGH);
+    measure_priority_latency("Probe latency, normal behind low: ", TFB_PRIORITY_LOW, TFB_PRIORITY_NORMAL);
+}
+
+#ifndef _WIN32
+void record_cpu_job(void* param)
+{
+    *(int*)param = sched_getcpu();
+}
+
+TEST_CASE("tinyfiber workers are pinned to the cpu list")
+{
+    // Given
+    const std::vector<utils::TinyCpu> cpus = utils::tiny_topology_cpus();
+    REQUIRE(!cpus.empty());
+    const int cpu_list[] = {cpus.back().cpu};
+    TfbInitDeclaration init_declaration{};
+    init_declaration.worker_affinity = TFB_AFFINITY_CPU_LIST;
+    init_declaration.cpu_list = cpu_list;
+    init_declaration.cpu_list_size = 1;
+    TfbContext* fs = nullptr;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When
+    int ran_on[64];
+    TfbWaitHandle wh{};
+    for (int& cpu : ran_on)
+    {
+        TfbJobDeclaration jd = {record_cpu_job, &cpu, &wh};
+        REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+    }
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then, one worker on the only cpu in the list
+    for (int cpu : ran_on)
+        CHECK(cpu == cpu_list[0]);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+#endif
+
+TEST_CASE("tinyfiber affinity declaration")
+{
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+
+    SUBCASE("physical cores")
+    {
+        init_declaration.worker_affinity = TFB_AFFINITY_PHYSICAL_CORES;
+        REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+        CHECK(tfb_active_workers_ext(fs) == (int)utils::tiny_topology_physical_cores(utils::tiny_topology_cpus()).size());
+        std::atomic_int64_t depth(64);
+        recursive_job(&depth);
+        CHECK(depth == 0);
+        REQUIRE(tfb_free_ext(&fs) == 0);
+    }
+
+    SUBCASE("empty cpu list is rejected")
+    {
+        init_declaration.worker_affinity = TFB_AFFINITY_CPU_LIST;
+        CHECK(tfb_init_decl_ext(&fs, &init_declaration) == -1);
+        CHECK(fs == nullptr);
+    }
+
+    SUBCASE("unknown cpu is rejected")
+    {
+        const int cpu_list[] = {1 << 20};
+        init_declaration.worker_affinity = TFB_AFFINITY_CPU_LIST;
+        init_declaration.cpu_list = cpu_list;
+        init_declaration.cpu_list_size = 1;
+        CHECK(tfb_init_decl_ext(&fs, &init_declaration) == -1);
+        CHECK(fs == nullptr);
+    }
+}
+
+// Every job walks its own buffer, larger than L1, so jobs that migrate between cores pay for it
+void cache_walk_job(void* param)
+{
+    std::vector<int64_t>& buffer = *(std::vector<int64_t>*)param;
+    for (int pass = 0; pass < 8; ++pass)
+    {
+        for (size_t i = 0; i < buffer.size(); i += 8)
+            buffer[i] += pass;
+    }
+}
+
+void measure_affinity_variance(const char* name, int worker_affinity)
+{
+    TfbContext* fs;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.worker_affinity = worker_affinity;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+    std::vector<std::vector<int64_t>> buffers(64, std::vector<int64_t>(32 * 1024));
+
+    const int rounds = 20;
+    double round_us[rounds];
+    for (double& us : round_us)
+    {
+        TfbWaitHandle wh{};
+        auto start = std::chrono::high_resolution_clock::now();
+        for (std::vector<int64_t>& buffer : buffers)
+        {
+            TfbJobDeclaration jd = {cache_walk_job, &buffer, &wh};
+            REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+        }
+        REQUIRE(tfb_await(&wh) == 0);
+        auto stop = std::chrono::high_resolution_clock::now();
+        us = (double)std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    }
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    double mean_us = 0;
+    for (double us : round_us)
+        mean_us += us / rounds;
+    double variance = 0;
+    for (double us : round_us)
+        variance += (us - mean_us) * (us - mean_us) / rounds;
+    std::cout << name << std::endl;
+    std::cout << "Mean round us: " << mean_us << std::endl;
+    std::cout << "Stddev round us: " << std::sqrt(variance) << std::endl;
+}
+
+TEST_CASE("tinyfiber affinity variance")
+{
+    measure_affinity_variance("Cache walk, unpinned: ", TFB_AFFINITY_NONE);
+    measure_affinity_variance("Cache walk, pinned to physical cores: ", TFB_AFFINITY_PHYSICAL_CORES);
+}
+
+void record_current_cpu_job(void* param)
+{
+    *(int*)param = utils::tiny_topology_current_cpu();
+}
+
+TEST_CASE("tinyfiber node hints")
+{
+    // Given workers on every physical core, grouped by NUMA node
+    const std::vector<utils::TinyCpu> cpus = utils::tiny_topology_cpus();
+    REQUIRE(!cpus.empty());
+    TfbInitDeclaration init_declaration{};
+    init_declaration.worker_affinity = TFB_AFFINITY_PHYSICAL_CORES;
+    TfbContext* fs = nullptr;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+    // When, one job for each node and one for a node that does not exist
+    std::vector<int> nodes;
+    for (const utils::TinyCpu& cpu : cpus)
+    {
+        if (std::find(nodes.begin(), nodes.end(), cpu.node) == nodes.end())
+            nodes.push_back(cpu.node);
+    }
+    std::vector<int> ran_on(nodes.size() + 1, -1);
+    TfbWaitHandle wh{};
+    for (size_t i = 0; i < ran_on.size(); ++i)
+    {
+        TfbJobDeclaration jd = {record_current_cpu_job, &ran_on[i], &wh};
+        jd.node = i < nodes.size() ? nodes[i] + 1 : 1 << 20;
+        REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+    }
+    REQUIRE(tfb_await(&wh) == 0);
+    TfbJobDeclaration invalid = {record_current_cpu_job, &ran_on[0], &wh};
+    invalid.node = -1;
+
+    // Then
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto cpu = std::find_if(cpus.begin(), cpus.end(), [&](const utils::TinyCpu& c) { return c.cpu == ran_on[i]; });
+        REQUIRE(cpu != cpus.end());
+        CHECK(cpu->node == nodes[i]);
+    }
+    CHECK(ran_on.back() >= 0);
+    CHECK(tfb_add_jobdecl_ext(fs, &invalid) == -1);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+// Streams through a buffer, far larger than the caches
+void stream_job(void* param)
+{
+    std::vector<int64_t>& buffer = *(std::vector<int64_t>*)param;
+    int64_t sum = 0;
+    for (int64_t value : buffer)
+        sum += value;
+    buffer[0] = sum;
+}
+
+// Pages are placed on the node of the worker that touches them first
+void first_touch_job(void* param)
+{
+    std::vector<int64_t>& buffer = *(std::vector<int64_t>*)param;
+    buffer.assign(256 * 1024, 1);
+}
+
+void measure_node_hints(const char* name, bool hint)
+{
+    const std::vector<utils::TinyCpu> cpus = utils::tiny_topology_cpus();
+    std::vector<int> nodes;
+    for (const utils::TinyCpu& cpu : cpus)
+    {
+        if (std::find(nodes.begin(), nodes.end(), cpu.node) == nodes.end())
+            nodes.push_back(cpu.node);
+    }
+
+    TfbContext* fs;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.worker_affinity = TFB_AFFINITY_PHYSICAL_CORES;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+    std::vector<std::vector<int64_t>> buffers(64);
+
+    TfbWaitHandle touched{};
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        TfbJobDeclaration jd = {first_touch_job, &buffers[i], &touched};
+        jd.node = nodes[i % nodes.size()] + 1;
+        REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+    }
+    REQUIRE(tfb_await(&touched) == 0);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < 10; ++round)
+    {
+        TfbWaitHandle wh{};
+        for (size_t i = 0; i < buffers.size(); ++i)
+        {
+            TfbJobDeclaration jd = {stream_job, &buffers[i], &wh};
+            jd.node = hint ? nodes[i % nodes.size()] + 1 : 0;
+            REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+        }
+        REQUIRE(tfb_await(&wh) == 0);
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    double us = (double)std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+    std::cout << name << std::endl;
+    std::cout << "Nodes: " << nodes.size() << std::endl;
+    std::cout << "Time: " << us << std::endl;
+}
+
+TEST_CASE("tinyfiber node hint performance")
+{
+    measure_node_hints("Streaming jobs, any node: ", false);
+    measure_node_hints("Streaming jobs, hinted to the node of their data: ", true);
+}
+
+void record_thread_job(void* param)
+{
+    std::thread::id* ran_on = (std::thread::id*)param;
+    *ran_on = current_thread_id();
+}
+
+// Polls from the main fiber, it keeps its own worker active
+bool wait_for_active_workers(int active_workers)
+{
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (tfb_active_workers_ext(TFB_MY_CONTEXT) != active_workers && std::chrono::steady_clock::now() < give_up)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return tfb_active_workers_ext(TFB_MY_CONTEXT) == active_workers;
+}
+
+TEST_CASE("tinyfiber set active workers")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, TFB_ALL_CORES) == 0);
+    const int workers = tfb_active_workers_ext(fs);
+    REQUIRE(workers >= 1);
+
+    // When all but one worker are parked
+    CHECK(tfb_set_active_workers_ext(fs, 0) == -1);
+    CHECK(tfb_set_active_workers_ext(fs, workers + 1) == -1);
+    REQUIRE(tfb_set_active_workers_ext(fs, 1) == 0);
+    REQUIRE(wait_for_active_workers(1));
+
+    std::thread::id ran_on[256];
+    int added = 0;
+    TfbWaitHandle wh{};
+    std::thread producer([&] {
+        for (std::thread::id& id : ran_on)
+            added += tfb_add_job_ext(fs, record_thread_job, &id, &wh) == 0 ? 1 : 0;
+    });
+    producer.join();
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then the remaining one runs every job, until the others are back
+    REQUIRE(added == 256);
+    CHECK(std::all_of(ran_on, ran_on + 256, [&](std::thread::id id) { return id == ran_on[0]; }));
+    REQUIRE(tfb_set_active_workers_ext(fs, workers) == 0);
+    CHECK(wait_for_active_workers(workers));
+    std::atomic_int64_t depth(64);
+    recursive_job(&depth);
+    CHECK(depth == 0);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+std::vector<int> numa_nodes()
+{
+    std::vector<int> nodes;
+    for (const utils::TinyCpu& cpu : utils::tiny_topology_cpus())
+    {
+        if (std::find(nodes.begin(), nodes.end(), cpu.node) == nodes.end())
+            nodes.push_back(cpu.node);
+    }
+    return nodes;
+}
+
+TEST_CASE("tinyfiber node hints to a parked node" * doctest::skip(numa_nodes().size() < 2))
+{
+    // Given one active worker, the nodes of all others are parked
+    TfbInitDeclaration init_declaration{};
+    init_declaration.worker_affinity = TFB_AFFINITY_PHYSICAL_CORES;
+    TfbContext* fs = nullptr;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+    REQUIRE(tfb_set_active_workers_ext(fs, 1) == 0);
+    REQUIRE(wait_for_active_workers(1));
+
+    // When, fewer jobs per node than it has workers
+    std::atomic_int64_t counter(0);
+    TfbWaitHandle wh{};
+    const std::vector<int> nodes = numa_nodes();
+    for (int node : nodes)
+    {
+        TfbJobDeclaration jd = {count_job, &counter, &wh};
+        jd.node = node + 1;
+        REQUIRE(tfb_add_jobdecl_ext(fs, &jd) == 0);
+    }
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then the active worker took them all
+    CHECK(counter == (int64_t)nodes.size());
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+void slow_active_workers_job(void* param)
+{
+    spin_for(std::chrono::microseconds(100));
+    std::atomic_int& max_active = *(std::atomic_int*)param;
+    int active = tfb_active_workers_ext(TFB_MY_CONTEXT);
+    int seen = max_active.load();
+    while (active > seen && !max_active.compare_exchange_weak(seen, active))
+    {
+    }
+}
+
+TEST_CASE("tinyfiber auto scale workers")
+{
+    // Given
+    TfbInitDeclaration init_declaration{};
+    init_declaration.auto_scale_workers = 1;
+    init_declaration.min_active_workers = 1;
+    init_declaration.park_idle_ms = 5;
+    TfbContext* fs;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+    const int workers = tfb_active_workers_ext(fs);
+
+    // When idle, workers park down to the minimum
+    CHECK(wait_for_active_workers(1));
+
+    // When a burst comes in, they come back
+    std::atomic_int max_active(0);
+    TfbWaitHandle wh{};
+    for (int i = 0; i < 256; ++i)
+        REQUIRE(tfb_add_job(slow_active_workers_job, &max_active, &wh) == 0);
+    REQUIRE(tfb_await(&wh) == 0);
+
+    // Then
+    CHECK(max_active >= std::min(workers, 2));
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
+// The main fiber blocks its worker while it waits for the producer, the others pick up the jobs
+void produce_jobs_with_gaps(TfbContext* fs, std::atomic_int64_t* counter, TfbWaitHandle* wh)
+{
+    std::thread producer([&] {
+        for (int i = 0; i < 10; ++i)
+        {
+            tfb_add_job_ext(fs, count_job, counter, wh);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    producer.join();
+    REQUIRE(tfb_await(wh) == 0);
+}
+
+// Idle workers never spin on a single CPU, they would take it from the submitter
+TEST_CASE("tinyfiber idle workers spin before they sleep" * doctest::skip(std::thread::hardware_concurrency() < 2))
+{
+    TfbContext* fs = nullptr;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.max_threads = 2;
+    std::atomic_int64_t counter(0);
+    TfbWaitHandle wh{};
+    TfbWorkerStats stats[2] = {};
+
+    SUBCASE("spin and yield")
+    {
+        // Given, spins that last longer than the gaps between the jobs
+        init_declaration.idle_spin_count = 1 << 30;
+        REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+        // When
+        produce_jobs_with_gaps(fs, &counter, &wh);
+
+        // Then
+        REQUIRE(tfb_worker_stats_ext(fs, stats, 2) == 2);
+        CHECK(stats[0].spin_wakeups + stats[1].spin_wakeups >= 9);
+    }
+
+    SUBCASE("straight to sleep")
+    {
+        // Given
+        init_declaration.idle_spin_count = -1;
+        init_declaration.idle_yield_count = -1;
+        REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+
+        // When
+        produce_jobs_with_gaps(fs, &counter, &wh);
+
+        // Then
+        REQUIRE(tfb_worker_stats_ext(fs, stats, 2) == 2);
+        CHECK(stats[0].spin_wakeups + stats[1].spin_wakeups == 0);
+        CHECK(stats[0].yield_wakeups + stats[1].yield_wakeups == 0);
+        CHECK(stats[0].sleeps + stats[1].sleeps >= 9);
+    }
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+    CHECK(counter == 10);
+}
+
+void measure_pickup_latency(const char* name, int idle_spin_count, int idle_yield_count)
+{
+    TfbContext* fs;
+    TfbInitDeclaration init_declaration{};
+    init_declaration.idle_spin_count = idle_spin_count;
+    init_declaration.idle_yield_count = idle_yield_count;
+    REQUIRE(tfb_init_decl_ext(&fs, &init_declaration) == 0);
+    std::atomic_int64_t counter(0);
+    ProbeState probes[1000];
+    TfbWaitHandle wh{};
+
+    // Frames of work with short gaps in between, the workers are idle when each probe is added. Needs two
+    // workers or more, the main fiber blocks one.
+    std::thread producer([&] {
+        for (ProbeState& probe : probes)
+        {
+            spin_for(std::chrono::microseconds(20));
+            probe = {&counter, -1, std::chrono::high_resolution_clock::now()};
+            TfbJobDeclaration jd = {probe_job, &probe, &wh};
+            while (tfb_add_jobdecl_ext(fs, &jd) != 0)
+                std::this_thread::yield();
+        }
+    });
+    producer.join();
+    REQUIRE(tfb_await(&wh) == 0);
+
+    std::vector<TfbWorkerStats> stats(tfb_worker_stats_ext(fs, nullptr, 0));
+    tfb_worker_stats_ext(fs, stats.data(), (int)stats.size());
+    REQUIRE(tfb_free_ext(&fs) == 0);
+
+    std::vector<double> latencies_us;
+    for (const ProbeState& probe : probes)
+        latencies_us.push_back((double)std::chrono::duration_cast<std::chrono::nanoseconds>(probe.started - probe.added).count() / 1000);
+    std::sort(latencies_us.begin(), latencies_us.end());
+    TfbWorkerStats total{};
+    for (const TfbWorkerStats& worker : stats)
+    {
+        total.spin_wakeups += worker.spin_wakeups;
+        total.yield_wakeups += worker.yield_wakeups;
+        total.sleeps += worker.sleeps;
+    }
+    std::cout << name << std::endl;
+    std::cout << "Workers: " << stats.size() << std::endl;
+    std::cout << "Median pickup us: " << latencies_us[latencies_us.size() / 2] << std::endl;
+    std::cout << "P99 pickup us: " << latencies_us[latencies_us.size() * 99 / 100] << std::endl;
+    std::cout << "Spin/yield wakeups, sleeps: " << total.spin_wakeups << "/" << total.yield_wakeups << ", " << total.sleeps << std::endl;
+}
+
+TEST_CASE("tinyfiber idle pickup latency" * doctest::skip(std::thread::hardware_concurrency() < 2))
+{
+    measure_pickup_latency("Pickup latency, spin then yield then sleep: ", 0, 0);
+    measure_pickup_latency("Pickup latency, sleep right away: ", -1, -1);
+}
+
+TEST_CASE("tinyfiber jobs from outside the fiber system")
+{
+    // Given
+    TfbContext* fs;
+    REQUIRE(tfb_init_ext(&fs, TFB_ALL_CORES) == 0);
+    std::atomic_int64_t counter(0);
+    TfbWaitHandle wh{};
+
+    // When, all jobs go through the shared job queue
+    int added = 0;
+    std::thread producer([&] {
+        for (int i = 0; i < 2000; ++i)
+            added += tfb_add_job_ext(fs, count_job, &counter, &wh) == 0 ? 1 : 0;
+    });
+    producer.join();
+    tfb_await(&wh);
+
+    // Then
+    CHECK(added == 2000);
+    CHECK(counter == 2000);
+
+    // Cleanup
+    REQUIRE(tfb_free_ext(&fs) == 0);
+}
+
 void job(void* param)
 {
     std::atomic_int64_t* depth = (std::atomic_int64_t*)param;
@@ -28,11 +28,14 @@ SOFTWARE.
 
 #include <thread>
 #include <cstdint>
+#include <cstring>
 #include <chrono>
 #include <iostream>
 #include <atomic>
+#include <algorithm>
 
 using utils::TinyRingBuffer;
+using utils::TinyRingBufferMode;
 using utils::TinyRingBufferStatus;
 
 namespace
@@ -58,6 +61,92 @@ static const int INTEGER_BUFFER_SIZE = 64 * 1024;
 static const int BIGGER_DATA_BUFFER_SIZE = 64 * 1024;
 static const int BUFFER_SIZE_SMALL = 64 * 1024;
 
+template <typename RingBuffer>
+void run_contention(const char* name)
+{
+    RingBuffer q;
+
+    CHECK(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+
+    int64_t total_time = 0;
+    std::atomic_int64_t total_starvations(0);
+    std::atomic_int64_t total_overflows(0);
+    for (int round = 0; round < 100; ++round)
+    {
+        ticktock();
+        std::atomic_int starvations(0);
+        std::atomic_int overflows(0);
+        std::atomic_int sum(0);
+
+        std::thread consumers[3];
+        for (int t = 0; t < 3; ++t)
+        {
+            consumers[t] = std::thread([&] {
+                for (int i = 1; i <= 20000; ++i)
+                {
+                    int d;
+                    while (q.dequeue(&d) != TinyRingBufferStatus::SUCCESS)
+                    {
+                        starvations++;
+                        std::this_thread::yield();
+                    }
+                    sum += d;
+                }
+            });
+        }
+
+        std::thread feeders1[3];
+        for (int t = 0; t < 3; ++t)
+        {
+            feeders1[t] = std::thread([&] {
+                for (int i = 1; i <= 10000; ++i)
+                {
+                    while (q.enqueue(i) != TinyRingBufferStatus::SUCCESS)
+                    {
+                        overflows++;
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (int t = 0; t < 3; ++t)
+            feeders1[t].join();
+
+        std::thread feeders2[3];
+        for (int t = 0; t < 3; ++t)
+        {
+            feeders2[t] = std::thread([&] {
+                for (int i = 1; i <= 10000; ++i)
+                {
+                    while (q.enqueue(i) != TinyRingBufferStatus::SUCCESS)
+                    {
+                        overflows++;
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for (int t = 0; t < 3; ++t)
+            feeders2[t].join();
+
+        for (int t = 0; t < 3; ++t)
+            consumers[t].join();
+
+        total_time += ticktock();
+        total_starvations += starvations;
+        total_overflows += overflows;
+        CHECK_EQ(sum, 300030000);
+    }
+
+    // 60000 enqueues and 60000 dequeues per round
+    std::cout << name << std::endl;
+    std::cout << "Time: " << total_time << std::endl;
+    std::cout << "Ops/s: " << 100 * 120000.0 / total_time * 1000000.0 << std::endl;
+    std::cout << "Starvations: " << total_starvations << std::endl;
+    std::cout << "Overflows: " << total_overflows << std::endl;
+    std::cout << std::endl;
+}
+
 } // namespace
 
 TEST_CASE("tinyringbuffer init")
@@ -85,6 +174,37 @@ TEST_CASE("tinyringbuffer free")
     CHECK(sts == TinyRingBufferStatus::SUCCESS);
 }
 
+TEST_CASE("tinyringbuffer batch wraps around")
+{
+    // Given, 24 byte elements do not divide the buffer so batches will straddle the end
+    TinyRingBuffer<BiggerDataStruct> q;
+    REQUIRE(q.init(BIGGER_DATA_BUFFER_SIZE) == TinyRingBufferStatus::SUCCESS);
+    BiggerDataStruct batch[100];
+    int64_t next_in = 0;
+    int64_t next_out = 0;
+    bool in_order = true;
+
+    // When
+    for (int round = 0; round < 1000; ++round)
+    {
+        for (int i = 0; i < 100; ++i)
+            batch[i] = BiggerDataStruct{next_in + i, -(next_in + i), 0.5};
+        REQUIRE(q.enqueue(batch, 100) == TinyRingBufferStatus::SUCCESS);
+        next_in += 100;
+
+        BiggerDataStruct d;
+        while (q.count() > 50 && q.dequeue(&d) == TinyRingBufferStatus::SUCCESS)
+        {
+            in_order = in_order && d.a == next_out && d.b == -next_out;
+            next_out++;
+        }
+    }
+
+    // Then
+    CHECK(in_order);
+    CHECK(next_in * (int64_t)sizeof(BiggerDataStruct) > 10 * q.buffer_size());
+}
+
 TEST_CASE("tinyringbuffer performance")
 {
     {
@@ -138,70 +258,276 @@ TEST_CASE("tinyringbuffer performance")
         std::cout << std::endl;
     }
 
-    TinyRingBuffer<int> q;
+    run_contention<TinyRingBuffer<int, TinyRingBufferMode::LOCKED>>("Contended Integer Data (locked): ");
+    run_contention<TinyRingBuffer<int, TinyRingBufferMode::MPMC>>("Contended Integer Data (mpmc): ");
+}
 
-    CHECK(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+TEST_CASE("tinyringbuffer mpmc")
+{
+    // Given
+    TinyRingBuffer<BiggerDataStruct, TinyRingBufferMode::MPMC> q;
+    REQUIRE(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
 
-    for (int round = 0; round < 100; ++round)
-    {
-        ticktock();
-        std::atomic_int starvations = 0;
-        std::atomic_int overflows = 0;
-        std::atomic_int stalls = 0;
-        std::atomic_int sum = 0;
+    // When
+    int64_t enqueued = 0;
+    while (q.enqueue(BiggerDataStruct{enqueued, -enqueued, 0.5}) == TinyRingBufferStatus::SUCCESS)
+        enqueued++;
 
-        std::thread consumers[3];
-        for (int t = 0; t < 3; ++t)
+    BiggerDataStruct first{};
+    TinyRingBufferStatus dequeue_sts = q.dequeue(&first);
+    TinyRingBufferStatus enqueue_sts = q.enqueue(BiggerDataStruct{enqueued, -enqueued, 0.5});
+
+    // Then
+    CHECK(enqueued == q.capacity());
+    CHECK(dequeue_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(enqueue_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(first.a == 0);
+    CHECK(first.b == 0);
+    CHECK(q.count() == q.capacity());
+}
+
+TEST_CASE("tinyringbuffer spsc")
+{
+    // Given
+    TinyRingBuffer<BiggerDataStruct, TinyRingBufferMode::SPSC> q;
+    REQUIRE(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+    const int64_t elements = 1000000;
+    const int64_t batch = 7;
+    bool in_order = true;
+    int64_t sum = 0;
+
+    // When
+    std::thread consumer([&] {
+        int64_t expected = 0;
+        BiggerDataStruct d[batch];
+        while (expected < elements)
         {
-            consumers[t] = std::thread([&] {
-                for (int i = 1; i <= 20000; ++i)
-                {
-                    int d;
-                    while (q.dequeue(&d) != TinyRingBufferStatus::SUCCESS)
-                    {
-                        starvations++;
-                    }
-                    sum += d;
-                }
-            });
+            int64_t n = std::min(batch, elements - expected);
+            if (q.dequeue(d, n) != TinyRingBufferStatus::SUCCESS)
+                continue;
+            for (int64_t i = 0; i < n; ++i)
+            {
+                in_order = in_order && d[i].a == expected && d[i].b == -expected;
+                sum += d[i].a;
+                expected++;
+            }
         }
+    });
 
-        std::thread feeders1[3];
-        for (int t = 0; t < 3; ++t)
+    for (int64_t i = 0; i < elements; ++i)
+    {
+        while (q.enqueue(BiggerDataStruct{i, -i, 0.5}) != TinyRingBufferStatus::SUCCESS)
+            std::this_thread::yield();
+    }
+    consumer.join();
+
+    // Then
+    CHECK(in_order);
+    CHECK(sum == elements * (elements - 1) / 2);
+    CHECK(q.empty());
+}
+
+namespace
+{
+template <typename RingBuffer>
+void run_single_producer(const char* name)
+{
+    RingBuffer q;
+    CHECK(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+
+    const int elements = 3000000;
+    int64_t sum = 0;
+    ticktock();
+    std::thread consumer([&] {
+        for (int i = 0; i < elements; ++i)
         {
-            feeders1[t] = std::thread([&] {
-                for (int i = 1; i <= 10000; ++i)
-                {
-                    while (q.enqueue(i) != TinyRingBufferStatus::SUCCESS)
-                    {
-                        overflows++;
-                    }
-                }
-            });
+            int d;
+            while (q.dequeue(&d) != TinyRingBufferStatus::SUCCESS)
+                std::this_thread::yield();
+            sum += d;
         }
-        for (int t = 0; t < 3; ++t)
-            feeders1[t].join();
+    });
+    for (int i = 0; i < elements; ++i)
+    {
+        while (q.enqueue(i) != TinyRingBufferStatus::SUCCESS)
+            std::this_thread::yield();
+    }
+    consumer.join();
+    int64_t time = ticktock();
+
+    CHECK(sum == (int64_t)elements * (elements - 1) / 2);
+    std::cout << name << std::endl;
+    std::cout << "Time: " << time << std::endl;
+    std::cout << "Ops/s: " << 2.0 * elements / time * 1000000.0 << std::endl;
+    std::cout << std::endl;
+}
+} // namespace
 
-        std::thread feeders2[3];
-        for (int t = 0; t < 3; ++t)
+TEST_CASE("tinyringbuffer spsc performance")
+{
+    run_single_producer<TinyRingBuffer<int, TinyRingBufferMode::LOCKED>>("Single Producer Integer Data (locked): ");
+    run_single_producer<TinyRingBuffer<int, TinyRingBufferMode::SPSC>>("Single Producer Integer Data (spsc): ");
+}
+
+TEST_CASE("tinyringbuffer reserve and commit")
+{
+    // Given
+    TinyRingBuffer<BiggerDataStruct> q;
+    REQUIRE(q.init(BIGGER_DATA_BUFFER_SIZE) == TinyRingBufferStatus::SUCCESS);
+
+    // When
+    BiggerDataStruct* slots = nullptr;
+    REQUIRE(q.reserve(3, &slots) == TinyRingBufferStatus::SUCCESS);
+    for (int64_t i = 0; i < 3; ++i)
+        slots[i] = BiggerDataStruct{i, -i, 0.5};
+    TinyRingBufferStatus commit_sts = q.commit(2);
+
+    const BiggerDataStruct* peeked = nullptr;
+    TinyRingBufferStatus peek_sts = q.peek(2, &peeked);
+    int64_t a0 = peeked[0].a;
+    int64_t a1 = peeked[1].a;
+    TinyRingBufferStatus release_sts = q.release(2);
+    TinyRingBufferStatus empty_sts = q.peek(1, &peeked);
+
+    // Then
+    CHECK(commit_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(peek_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(release_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(empty_sts == TinyRingBufferStatus::BUFFER_EMPTY);
+    CHECK(peeked == nullptr);
+    CHECK(a0 == 0);
+    CHECK(a1 == 1);
+    CHECK(q.empty());
+}
+
+TEST_CASE("tinyringbuffer spsc reserve and peek")
+{
+    // Given
+    TinyRingBuffer<BiggerDataStruct, TinyRingBufferMode::SPSC> q;
+    REQUIRE(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+    const int64_t batches = 100000;
+    const int64_t batch = 5;
+    bool in_order = true;
+
+    // When
+    std::thread consumer([&] {
+        int64_t expected = 0;
+        while (expected < batches * batch)
         {
-            feeders2[t] = std::thread([&] {
-                for (int i = 1; i <= 10000; ++i)
-                {
-                    while (q.enqueue(i) != TinyRingBufferStatus::SUCCESS)
-                    {
-                        overflows++;
-                    }
-                }
-            });
+            const BiggerDataStruct* d;
+            if (q.peek(batch, &d) != TinyRingBufferStatus::SUCCESS)
+                continue;
+            for (int64_t i = 0; i < batch; ++i)
+            {
+                in_order = in_order && d[i].a == expected;
+                expected++;
+            }
+            q.release(batch);
         }
-        for (int t = 0; t < 3; ++t)
-            feeders2[t].join();
+    });
 
-        for (int t = 0; t < 3; ++t)
-            consumers[t].join();
+    for (int64_t b = 0; b < batches; ++b)
+    {
+        BiggerDataStruct* d;
+        while (q.reserve(batch, &d) != TinyRingBufferStatus::SUCCESS)
+            std::this_thread::yield();
+        for (int64_t i = 0; i < batch; ++i)
+            d[i] = BiggerDataStruct{b * batch + i, 0, 0.0};
+        q.commit(batch);
+    }
+    consumer.join();
 
-        int64_t time = ticktock();
-        CHECK_EQ(sum, 300030000);
+    // Then
+    CHECK(in_order);
+    CHECK(q.empty());
+}
+
+namespace
+{
+template <typename T>
+void run_consumer(const char* name, const T& value)
+{
+    TinyRingBuffer<T> q;
+    CHECK(q.init(BUFFER_SIZE_SMALL) == TinyRingBufferStatus::SUCCESS);
+    const int64_t elements = q.buffer_size() / (int64_t)sizeof(T);
+    const int64_t rounds = 4000000 / elements;
+
+    int64_t time = 0;
+    for (int64_t round = 0; round < rounds; ++round)
+    {
+        for (int64_t i = 0; i < elements; ++i)
+            q.enqueue(value);
+
+        ticktock();
+        T d;
+        for (int64_t i = 0; i < elements; ++i)
+            q.dequeue(&d);
+        time += ticktock();
     }
+
+    std::cout << name << (TinyRingBuffer<T>::is_poisoning() ? " (poisoned)" : "") << std::endl;
+    std::cout << "Time: " << time << std::endl;
+    std::cout << "Ops/s: " << (double)(rounds * elements) / time * 1000000.0 << std::endl;
+    std::cout << std::endl;
+}
+} // namespace
+
+// Compare poisoning by building with -DTINYFIBER_POISON_RING_BUFFERS=ON and OFF
+TEST_CASE("tinyringbuffer consumer performance")
+{
+    run_consumer<int>("Consumer Integer Data", 1);
+    run_consumer<BiggerDataStruct>("Consumer Bigger Data", BiggerDataStruct{1, 2, 0.5});
+}
+
+TEST_CASE("tinyringbuffer poisons consumed elements in poisoning builds")
+{
+    // Given
+    TinyRingBuffer<int> q;
+    REQUIRE(q.init(INTEGER_BUFFER_SIZE) == TinyRingBufferStatus::SUCCESS);
+    REQUIRE(q.enqueue(42) == TinyRingBufferStatus::SUCCESS);
+    const int* consumed = nullptr;
+    REQUIRE(q.peek(1, &consumed) == TinyRingBufferStatus::SUCCESS);
+    REQUIRE(q.release(0) == TinyRingBufferStatus::SUCCESS);
+    REQUIRE(consumed != nullptr);
+
+    // When
+    int d = 0;
+    TinyRingBufferStatus sts = q.dequeue(&d);
+
+    // Then
+    CHECK(sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(d == 42);
+    if (TinyRingBuffer<int>::is_poisoning())
+        CHECK(*(const volatile unsigned char*)consumed == 0xAB);
+    else
+        CHECK(*(const volatile int*)consumed == 42);
+}
+
+TEST_CASE("tinyringbuffer bulk dequeue")
+{
+    // Given
+    TinyRingBuffer<int> q;
+    REQUIRE(q.init(INTEGER_BUFFER_SIZE) == TinyRingBufferStatus::SUCCESS);
+    int src[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    REQUIRE(q.enqueue(src, 10) == TinyRingBufferStatus::SUCCESS);
+
+    // When
+    int dst[10] = {};
+    int too_many[7] = {};
+    TinyRingBufferStatus sts = q.dequeue(dst, 4);
+    TinyRingBufferStatus too_many_sts = q.dequeue(too_many, 7);
+    int64_t dequeued = 0;
+    TinyRingBufferStatus up_to_sts = q.dequeue_up_to(dst + 4, 100, &dequeued);
+    int64_t dequeued_empty = -1;
+    TinyRingBufferStatus empty_sts = q.dequeue_up_to(dst, 100, &dequeued_empty);
+
+    // Then
+    CHECK(sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(too_many_sts == TinyRingBufferStatus::BUFFER_EMPTY);
+    CHECK(up_to_sts == TinyRingBufferStatus::SUCCESS);
+    CHECK(dequeued == 6);
+    CHECK(empty_sts == TinyRingBufferStatus::BUFFER_EMPTY);
+    CHECK(dequeued_empty == 0);
+    for (int i = 0; i < 10; ++i)
+        CHECK(dst[i] == i);
 }
@@ -0,0 +1,87 @@
+/*
+MIT License
+
+Copyright (c) 2020 Markus Lindelöw
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <tinytopology.hpp>
+
+#include "doctest.hpp"
+
+#include <algorithm>
+#include <thread>
+
+using utils::TinyCpu;
+
+TEST_CASE("tinytopology cpus")
+{
+    // Given
+
+    // When
+    std::vector<TinyCpu> cpus = utils::tiny_topology_cpus();
+    std::vector<int> cores = utils::tiny_topology_physical_cores(cpus);
+
+    // Then
+    REQUIRE(!cpus.empty());
+    CHECK(cpus.size() <= std::thread::hardware_concurrency());
+    CHECK(!cores.empty());
+    CHECK(cores.size() <= cpus.size());
+    for (size_t i = 1; i < cpus.size(); ++i)
+        CHECK(cpus[i - 1].cpu < cpus[i].cpu);
+    for (int core : cores)
+        CHECK(std::any_of(cpus.begin(), cpus.end(), [&](const TinyCpu& cpu) { return cpu.cpu == core; }));
+    for (const TinyCpu& cpu : cpus)
+        CHECK(cpu.node >= 0);
+}
+
+TEST_CASE("tinytopology physical cores skip siblings")
+{
+    // Given two packages with two cores of two threads each
+    std::vector<TinyCpu> cpus = {{0, 0, 0}, {1, 1, 0}, {2, 0, 1}, {3, 1, 1}, {4, 0, 0}, {5, 1, 0}, {6, 0, 1}, {7, 1, 1}};
+
+    // When
+    std::vector<int> cores = utils::tiny_topology_physical_cores(cpus);
+
+    // Then
+    CHECK(cores == std::vector<int>{0, 1, 2, 3});
+}
+
+TEST_CASE("tinytopology pin thread")
+{
+    // Given
+    std::vector<TinyCpu> cpus = utils::tiny_topology_cpus();
+    REQUIRE(!cpus.empty());
+    const int cpu = cpus.back().cpu;
+
+    // When
+    bool pinned = false;
+    int running_on = -1;
+    std::thread thread([&] {
+        pinned = utils::tiny_topology_pin_thread(cpu);
+        running_on = utils::tiny_topology_current_cpu();
+    });
+    thread.join();
+
+    // Then
+    CHECK(pinned);
+    CHECK(running_on == cpu);
+    CHECK(!utils::tiny_topology_pin_thread(-1));
+}